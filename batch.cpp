@@ -0,0 +1,182 @@
+// Runs a list of headless jobs across every core - for regression runs and anything else that needs a lot of ROMs, movies and frame
+// counts run at once. Only needs the core (nes.cpp, cpu.cpp, ppu.cpp, ppu_pipeline.cpp, tile_decode.cpp, mmc3.cpp, movie.cpp) and
+// work_pool.cpp, not SDL
+//
+//     batch <job list> [--threads n] [--results file]
+//
+// The job list has a job per line: a ROM, then optionally a movie (or - for none) and a frame count. Anything with spaces in it goes
+// in double quotes, and lines starting with # are skipped:
+//
+//     "Donkey Kong (World) (Rev A).nes" dk.snm
+//     "Donkey Kong (World) (Rev A).nes" - 3600
+//
+// Jobs with a movie run it from its start state with its input, for the whole movie unless a frame count is given, and the state
+// they end in is checked against the recording. Jobs without one run 600 frames with nothing held unless told otherwise
+// The results file (batch_results.txt unless --results says otherwise) gets a tab separated line per job, in the order they were
+// listed: the job, the final frame and state hashes, how long it took and how it went, plus why for a job that stopped partway
+// (a ROM running into an opcode the CPU doesn't know, say). Exits with 1 if any job failed or mismatched
+#include "nes.h"
+#include "movie.h"
+#include "work_pool.h"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <thread>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+
+struct Job {
+    std::string rom;
+    std::string movie;
+    // 0 for the movie's length, or 600 frames without one
+    unsigned long long frames;
+};
+
+struct JobResult {
+    // ok, match, MISMATCH or error
+    std::string status = "error";
+    unsigned long long frames = 0;
+    uint64_t frame_hash = 0;
+    uint64_t state_hash = 0;
+    double milliseconds = 0;
+    // What stopped the job, if the core threw partway through it
+    std::string message;
+};
+
+// Each thread keeps one of these for every job it runs, so nothing big is allocated once the batch has started
+struct Worker {
+    NES nes;
+    Movie movie;
+};
+
+static void usage() {
+    std::cout << "Usage: batch <job list> [--threads n] [--results file]" << std::endl;
+}
+
+static bool read_jobs(const char * filename, std::vector<Job>& jobs) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cout << "Error: " << filename << " could not be opened." << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int number = 0;
+    while (std::getline(file, line)) {
+        number++;
+        std::istringstream fields(line);
+        Job job = {"", "", 0};
+        if (!(fields >> std::quoted(job.rom)) || job.rom[0] == '#') continue;
+        if (fields >> std::quoted(job.movie) && job.movie == "-") job.movie.clear();
+        fields >> std::ws;
+        if (!fields.eof() && !(fields >> job.frames)) {
+            std::cout << "Error: line " << number << " of " << filename << " has a bad frame count." << std::endl;
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+static void run_job(Worker& worker, const Job& job, JobResult& result) {
+
+    auto start = std::chrono::steady_clock::now();
+    // The core throws when a ROM does something it can't handle, which would otherwise take the whole batch down with it. The
+    // job is just marked as an error, and the worker's NES gets reloaded by the next job anyway
+    try {
+        NES& nes = worker.nes;
+        if (!nes.load_rom(job.rom.c_str())) return;
+        nes.reset();
+
+        bool has_movie = !job.movie.empty();
+        if (has_movie && (!worker.movie.load(job.movie.c_str()) || !worker.movie.start_playback(nes))) return;
+        int movie_frames = has_movie ? worker.movie.get_frames() : 0;
+        unsigned long long frames = job.frames ? job.frames : has_movie ? movie_frames : 600;
+
+        for (unsigned long long i = 0; i < frames; i++) {
+            nes.cpu.set_controllers(i < (unsigned long long) movie_frames ? worker.movie.get_input(i) : ControllerSnapshot());
+            nes.run_frame();
+        }
+
+        result.frames = frames;
+        result.frame_hash = nes.ppu.get_frame_hash();
+        result.state_hash = Movie::hash_state(nes);
+        // The final state can only be checked if the job stopped exactly where recording did
+        if (has_movie && frames == (unsigned long long) movie_frames) {
+            result.status = result.state_hash == worker.movie.get_final_hash() ? "match" : "MISMATCH";
+        }
+        else result.status = "ok";
+    }
+    catch (const std::exception& error) {
+        result.status = "error";
+        result.message = error.what();
+    }
+    result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+}
+
+int main(int argc, char *argv []) {
+    const char * job_file = nullptr;
+    const char * results_file = "batch_results.txt";
+    int threads = std::max(1, (int) std::thread::hardware_concurrency());
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--threads" && has_value) threads = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--results" && has_value) results_file = argv[++i];
+        else if (!job_file && arg[0] != '-') job_file = argv[i];
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (!job_file) {
+        usage();
+        return 2;
+    }
+
+    std::vector<Job> jobs;
+    if (!read_jobs(job_file, jobs)) return 1;
+    threads = std::min<int>(threads, std::max<size_t>(1, jobs.size()));
+
+    // A few hundred KB each, so they're allocated once up front rather than for every job
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int i = 0; i < threads; i++) workers.push_back(std::make_unique<Worker>());
+    std::vector<JobResult> results(jobs.size());
+
+    WorkStealingPool pool(threads);
+    auto start = std::chrono::steady_clock::now();
+    pool.run((int) jobs.size(), [&](int worker, int index) { run_job(*workers[worker], jobs[index], results[index]); });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::ofstream out(results_file);
+    out << "# job\trom\tmovie\tframes\tframe hash\tstate hash\tms\tstatus\tmessage\n";
+    unsigned long long total_frames = 0;
+    int failed = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const JobResult& result = results[i];
+        out << i << '\t' << jobs[i].rom << '\t' << (jobs[i].movie.empty() ? "-" : jobs[i].movie) << '\t' << result.frames << '\t'
+            << std::hex << std::setfill('0') << std::setw(16) << result.frame_hash << '\t' << std::setw(16) << result.state_hash
+            << std::dec << '\t' << std::fixed << std::setprecision(1) << result.milliseconds << '\t' << result.status << '\t'
+            << (result.message.empty() ? "-" : result.message) << '\n';
+        total_frames += result.frames;
+        if (result.status == "error" || result.status == "MISMATCH") failed++;
+    }
+    if (!out) {
+        std::cout << "Error: couldn't write " << results_file << std::endl;
+        return 1;
+    }
+
+    std::cout << "Ran " << jobs.size() << " jobs (" << total_frames << " frames) on " << threads << " threads in " << std::fixed
+              << std::setprecision(3) << seconds << " s - " << std::setprecision(1) << total_frames / seconds << " frames/s, "
+              << pool.get_steals() << " jobs stolen" << std::endl;
+    if (failed) std::cout << "  " << failed << " jobs failed or didn't match - see " << results_file << std::endl;
+    std::cout << "  results written to " << results_file << std::endl;
+    return failed ? 1 : 0;
+}
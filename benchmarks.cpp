@@ -0,0 +1,312 @@
+#include "benchmarks.h"
+#include "nes.h"
+#include "movie.h"
+#include "rewind.h"
+#include "tile_decode.h"
+#include "video_filter.h"
+#include "ntsc_filter.h"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <thread>
+
+// Reads just the first 8KB of CHR ROM out of a ROM - for the benchmarks that only run the PPU or decode tiles
+static bool load_chr(std::vector<uint8_t>& chr, const char * filename) {
+    std::ifstream rom(filename, std::ios::in | std::ios::binary);
+
+    if (!rom.is_open()) {
+        std::cout << "Error: ROM could not be opened. Please make sure the file path is correct." << std::endl;
+        return false;
+    }
+
+    char header[16];
+    rom.read(header, 16);
+    // Skip the trainer (if there is one) and PRG ROM to get to CHR ROM
+    int chr_offset = 16 + ((header[6] & 4) ? 512 : 0) + 16384 * (uint8_t) header[4];
+    rom.seekg(chr_offset);
+    chr.resize(0x2000);
+    rom.read(reinterpret_cast<char *>(chr.data()), 0x2000);
+    return true;
+}
+
+// Runs the PPU on its own for a number of frames using both the table driven tick and the old branching tick and prints how long
+// each one took. The pattern tables are loaded from the given ROM and rendering is forced on so the fetch/pixel paths get exercised
+bool ppu_benchmark(const char * rom, int frames) {
+    std::vector<uint8_t> chr;
+    if (!load_chr(chr, rom)) return false;
+    auto ppu = std::make_unique<PPU>();
+    ppu->set_chr_rom(chr.data(), chr.size());
+    ppu->set_ppumask(0x1E);
+
+    // Both versions start from the exact same state
+    auto table_ppu = std::make_unique<PPU>(*ppu);
+    auto branching_ppu = std::make_unique<PPU>(*ppu);
+    long long dots = 341LL * 262 * frames;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (long long i = 0; i < dots; i++) table_ppu->tick();
+    auto table_time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    start = std::chrono::high_resolution_clock::now();
+    for (long long i = 0; i < dots; i++) branching_ppu->tick_branching();
+    auto branching_time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    bool same = std::equal(table_ppu->frame_buffer, table_ppu->frame_buffer + 256 * 240 * 4, branching_ppu->frame_buffer);
+
+    std::cout << "PPU benchmark (" << frames << " frames)" << std::endl;
+    std::cout << "  table driven: " << table_time << " ms (" << table_time / frames << " ms/frame)" << std::endl;
+    std::cout << "  branching:    " << branching_time << " ms (" << branching_time / frames << " ms/frame)" << std::endl;
+    std::cout << "  speedup:      " << branching_time / table_time << "x" << std::endl;
+    std::cout << "  frame buffers " << (same ? "match" : "DO NOT match") << std::endl;
+    return same;
+}
+
+bool frameskip_benchmark(const char * rom, int frames) {
+    auto nes = std::make_unique<NES>();
+    const int ratios[] = {1, 2, 3, 4, 8};
+    double base_time = 0;
+    uint64_t base_state = 0;
+    bool same = true;
+
+    std::cout << "Frameskip benchmark (" << frames << " frames)" << std::endl;
+    for (int ratio : ratios) {
+        // Every ratio starts from power on
+        if (!nes->load_rom(rom)) return false;
+        nes->reset();
+        nes->ppu.set_frameskip(ratio);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < frames; i++) nes->run_frame();
+        auto time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+        uint64_t state = Movie::hash_state(*nes);
+        if (ratio == 1) {
+            base_time = time;
+            base_state = state;
+        }
+        same = same && state == base_state;
+        std::cout << "  draw 1 in " << ratio << ": " << time << " ms (" << time / frames << " ms/frame, " << base_time / time
+                  << "x)" << (state == base_state ? "" : " - final state DOESN'T MATCH") << std::endl;
+    }
+    return same;
+}
+
+bool tile_decode_test(const char * rom, int passes) {
+    std::vector<uint8_t> chr;
+    if (!load_chr(chr, rom)) return false;
+
+    bool self_test = tile_decode_self_test();
+    std::cout << "Tile decode (" << tile_decode_kernel_name() << ")" << std::endl;
+    std::cout << "  self test " << (self_test ? "passed" : "FAILED") << std::endl;
+
+    // 512 tiles, 8 rows each. The low bitplane of a row is 8 bytes before the high one
+    const int rows = 512 * 8;
+    std::vector<uint8_t> low(rows), high(rows), palette(rows), out(rows * 8);
+    for (int i = 0; i < rows; i++) {
+        low[i] = chr[(i / 8) * 16 + i % 8];
+        high[i] = chr[(i / 8) * 16 + i % 8 + 8];
+        palette[i] = i & 3;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < passes; i++) decode_tile_rows_scalar(low.data(), high.data(), palette.data(), out.data(), rows);
+    auto scalar_time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::vector<uint8_t> scalar_out = out;
+
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < passes; i++) decode_tile_rows(low.data(), high.data(), palette.data(), out.data(), rows);
+    auto fast_time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    std::cout << "  scalar:  " << scalar_time << " ms (" << passes << " passes of " << rows << " rows)" << std::endl;
+    std::cout << "  " << tile_decode_kernel_name() << ": " << fast_time << " ms (" << scalar_time / fast_time << "x)" << std::endl;
+    std::cout << "  output " << (out == scalar_out ? "matches" : "DOES NOT match") << std::endl;
+    return self_test && out == scalar_out;
+}
+
+// Times each of the upscaling filters on a frame of every tile in the pattern tables, both on this thread alone and through the
+// worker pool, and prints how many megapixels (of output) per second each one manages. The pool has to come up with exactly what
+// the filter does on one thread
+bool filter_benchmark(const char * rom, int frames) {
+    std::vector<uint8_t> chr;
+    if (!load_chr(chr, rom)) return false;
+    auto ppu = std::make_unique<PPU>();
+    ppu->set_chr_rom(chr.data(), chr.size());
+
+    // Fill the first nametable with tiles 0 - 255 over and over, give the palettes some colors, and draw a frame of it
+    ppu->set_ppuaddr(0x20);
+    ppu->set_ppuaddr(0x00);
+    for (int i = 0; i < 0x400; i++) ppu->set_ppudata(i < 0x3C0 ? i & 0xFF : (i * 0x1B) & 0xFF);
+    ppu->set_ppuaddr(0x3F);
+    ppu->set_ppuaddr(0x00);
+    for (int i = 0; i < 32; i++) ppu->set_ppudata((i * 7) & 0x3F);
+    ppu->set_ppuaddr(0x00);
+    ppu->set_ppuaddr(0x00);
+    ppu->set_ppumask(0x1E);
+    std::vector<uint16_t> indices(256 * 240);
+    ppu->set_index_target(indices.data());
+    for (long long i = 0; i < 341LL * 262 * 2; i++) ppu->tick();
+    ppu->set_index_target(nullptr);
+
+    int threads = std::max(1, (int) std::thread::hardware_concurrency() / 2);
+    bool same = true;
+    std::cout << "Filter benchmark (" << frames << " frames, " << threads << " worker threads)" << std::endl;
+    for (int filter = FILTER_NONE + 1; filter < FILTER_COUNT; filter++) {
+        const FilterInfo* info = get_filter_info(filter);
+        int width = 256 * info->scale, height = 240 * info->scale;
+        std::vector<uint32_t> output(width * height);
+        const uint32_t* frame = reinterpret_cast<const uint32_t*>(ppu->frame_buffer);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < frames; i++) info->kernel(frame, output.data(), width, 0, 240);
+        double single_time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        std::vector<uint32_t> single_output = output;
+
+        FilterPipeline pipeline(filter, threads);
+        start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < frames; i++) {
+            std::copy_n(ppu->frame_buffer, 256 * 240 * 4, pipeline.get_input());
+            pipeline.submit(reinterpret_cast<uint8_t*>(output.data()), width * 4);
+        }
+        pipeline.wait();
+        double pool_time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+        bool pooled_same = output == single_output;
+        same = same && pooled_same;
+
+        double megapixels = (double) width * height * frames / 1000000;
+        std::cout << "  " << info->name << (info->vectorized ? "" : " (scalar)") << ": " << megapixels / single_time
+                  << " MP/s on one thread, " << megapixels / pool_time << " MP/s pooled (" << 1000 * pool_time / frames << " ms/frame"
+                  << (pooled_same ? "" : ", pooled output DOESN'T MATCH") << ")" << std::endl;
+    }
+
+    // NTSC isn't pooled, it runs on the emulation thread
+    std::unique_ptr<NtscFilter> ntsc = std::make_unique<NtscFilter>();
+    std::vector<uint8_t> output(NtscFilter::WIDTH * NtscFilter::HEIGHT * 4);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < frames; i++) ntsc->filter(indices.data(), output.data(), NtscFilter::WIDTH * 4, i);
+    double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    double megapixels = (double) NtscFilter::WIDTH * NtscFilter::HEIGHT * frames / 1000000;
+    std::cout << "  ntsc: " << megapixels / time << " MP/s (" << 1000 * time / frames << " ms/frame)" << std::endl;
+    return same;
+}
+
+// Runs a ROM with a frame's state going into a rewind buffer after every frame, the same as with rewind on, and reports what that
+// costs next to emulating the frame. Then rewinds all the way back, checking that each frame comes out the same the second time
+bool rewind_benchmark(const char * rom, int frames) {
+    auto nes = std::make_unique<NES>();
+    if (!nes->load_rom(rom)) return false;
+    nes->reset();
+
+    std::vector<uint8_t> state(nes->get_state_size());
+    RewindBuffer buffer(state.size(), frames, frames * 2048);
+    std::vector<uint64_t> hashes;
+    double run_time = 0, capture_time = 0;
+    // Something has to happen on screen for the deltas to be realistic, so start the game and wander back and forth
+    for (int i = 0; i < frames; i++) {
+        ControllerSnapshot input = {};
+        if (i >= 100 && i < 105) input.buttons[0] = BUTTON_START;
+        else if (i > 300) input.buttons[0] = (i / 90) % 2 ? BUTTON_RIGHT : BUTTON_LEFT | BUTTON_A;
+        nes->cpu.set_controllers(input);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        nes->run_frame();
+        auto captured = std::chrono::high_resolution_clock::now();
+        nes->save_state(state.data(), state.size());
+        buffer.push(state.data());
+        auto end = std::chrono::high_resolution_clock::now();
+
+        run_time += std::chrono::duration<double, std::micro>(captured - start).count();
+        capture_time += std::chrono::duration<double, std::micro>(end - captured).count();
+        hashes.push_back(nes->ppu.get_frame_hash());
+    }
+
+    std::cout << "Rewind benchmark (" << frames << " frames, " << state.size() << " byte states)" << std::endl;
+    std::cout << "  emulation " << run_time / frames << " us/frame, capture " << capture_time / frames << " us/frame ("
+              << 100 * capture_time / run_time << "% overhead)" << std::endl;
+    std::cout << "  " << buffer.get_frames() << " frames kept in " << buffer.get_bytes_used() / 1024 << " KB ("
+              << buffer.get_bytes_per_minute() / (1024 * 1024) << " MB a minute)" << std::endl;
+
+    // Each state is from the end of a frame, so running on from it has to draw the frame after it again
+    int mismatches = 0, checked = 0;
+    buffer.pop(state.data());
+    for (int i = (int) hashes.size() - 2; i >= 0 && buffer.pop(state.data()); i--) {
+        nes->load_state(state.data(), state.size());
+        nes->run_frame();
+        if (nes->ppu.get_frame_hash() != hashes[i + 1]) mismatches++;
+        checked++;
+    }
+    std::cout << "  rewound " << checked << " frames, " << mismatches << " mismatched" << std::endl;
+    return mismatches == 0;
+}
+
+// Times saving and loading a state partway into a game, then checks that loading the state carries on exactly the way the game
+// did the first time round - the first time round being straight on from where it was saved, without any loading
+bool save_state_benchmark(const char * rom, int iterations) {
+    auto nes = std::make_unique<NES>();
+    if (!nes->load_rom(rom)) return false;
+    nes->reset();
+    for (int i = 0; i < 300; i++) {
+        ControllerSnapshot input = {};
+        if (i >= 100 && i < 105) input.buttons[0] = BUTTON_START;
+        nes->cpu.set_controllers(input);
+        nes->run_frame();
+    }
+    auto play = [&nes] {
+        for (int i = 0; i < 120; i++) {
+            ControllerSnapshot input = {};
+            input.buttons[0] = (i / 30) % 2 ? BUTTON_RIGHT : BUTTON_LEFT | BUTTON_A;
+            nes->cpu.set_controllers(input);
+            nes->run_frame();
+        }
+    };
+
+    std::vector<uint8_t> state(nes->get_state_size());
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations; i++) nes->save_state(state.data(), state.size());
+    double save_time = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+
+    play();
+    uint64_t expected_hash = nes->ppu.get_frame_hash();
+    uint64_t expected_cycles = nes->cpu.get_cycle_count();
+
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations; i++) nes->load_state(state.data(), state.size());
+    double load_time = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+
+    play();
+    bool matches = nes->ppu.get_frame_hash() == expected_hash && nes->cpu.get_cycle_count() == expected_cycles;
+
+    std::cout << "Save state benchmark (" << state.size() << " byte states, version " << STATE_VERSION << ")" << std::endl;
+    std::cout << "  save " << save_time / iterations << " us, load " << load_time / iterations << " us" << std::endl;
+    std::cout << "  loaded state " << (matches ? "matches" : "DOESN'T MATCH") << " the original after 120 frames" << std::endl;
+    return matches;
+}
+
+struct Benchmark {
+    const char * name;
+    int default_count;
+    bool (*run)(const char * rom, int count);
+};
+
+static const Benchmark benchmarks[] = {
+    {"ppu", 600, ppu_benchmark},
+    {"frameskip", 600, frameskip_benchmark},
+    {"tile-decode", 1000, tile_decode_test},
+    {"filters", 100, filter_benchmark},
+    {"rewind", 3600, rewind_benchmark},
+    {"save-state", 10000, save_state_benchmark},
+};
+
+bool run_benchmark(const char * name, const char * rom, int count) {
+    for (const Benchmark& benchmark : benchmarks) {
+        if (name == std::string(benchmark.name)) return benchmark.run(rom, count > 0 ? count : benchmark.default_count);
+    }
+    std::cout << "Error: there's no benchmark called " << name << ". The benchmarks are:";
+    for (const Benchmark& benchmark : benchmarks) std::cout << " " << benchmark.name;
+    std::cout << std::endl;
+    return false;
+}
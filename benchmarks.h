@@ -0,0 +1,23 @@
+#pragma once
+
+// Benchmarks and self checks that only need the core, run through the headless runner (headless <rom> --benchmark name). Each
+// one prints what it measured and returns false if any of its checks failed. count is frames, passes or iterations depending on
+// the benchmark, or 0 for its usual amount
+
+// Runs the named benchmark on rom - prints the names there are and returns false if there's no such benchmark
+bool run_benchmark(const char * name, const char * rom, int count);
+
+bool ppu_benchmark(const char * rom, int frames);
+// Runs the ROM for a number of frames drawing 1 in 1, 2, 3, 4 and 8 of them, and prints how much faster each is than drawing every
+// frame. Skipped frames still have to do everything else, so the console has to end up in the same state every time
+bool frameskip_benchmark(const char * rom, int frames);
+// Checks every tile row decoder against the scalar one (see tile_decode_self_test), then times decoding every row of every tile in
+// the ROM's first pattern tables with the scalar version and the one picked for this CPU
+bool tile_decode_test(const char * rom, int passes);
+// Times each upscaling filter and the NTSC filter on a frame of the ROM's tiles, on one thread and (upscaling only) through the
+// worker pool, checking the pool's output against the single threaded one
+bool filter_benchmark(const char * rom, int frames);
+// Times capturing every frame into a rewind buffer while playing, then checks that rewinding through it draws the same frames
+bool rewind_benchmark(const char * rom, int frames);
+// Times saving and loading a state partway into a game, and checks that the game carries on the same way after loading it
+bool save_state_benchmark(const char * rom, int iterations);
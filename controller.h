@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdint>
+
+// Standard controller buttons, as bits in the order the console reads them out of 0x4016/0x4017
+enum ControllerButton {
+    BUTTON_A = 0x01,
+    BUTTON_B = 0x02,
+    BUTTON_SELECT = 0x04,
+    BUTTON_START = 0x08,
+    BUTTON_UP = 0x10,
+    BUTTON_DOWN = 0x20,
+    BUTTON_LEFT = 0x40,
+    BUTTON_RIGHT = 0x80
+};
+
+// What's held on both controllers. The frontend samples its input into one of these at frame boundaries and hands it to the core
+// (see CPU::set_controllers), which is all the core ever sees of input
+struct ControllerSnapshot {
+    uint8_t buttons[2];
+};
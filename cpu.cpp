@@ -1,4 +1,6 @@
 #include "cpu.h"
+#include <cstring>
+#include <algorithm>
 #include <unordered_map>
 #include <stdexcept>
 #include <string>
@@ -86,8 +88,15 @@ CPU::CPU(int memory_mapper) {
     programCounter = 0xFFFC;
 
     mem_map = memory_mapper;
+    cycle_count = 0;
+    cyc_cnt = 0;
 
     ppu = nullptr;
+    prg_rom = nullptr;
+    prg_rom_size = 0;
+    controllers = ControllerSnapshot();
+    controller_strobe = false;
+    controller_shift[0] = controller_shift[1] = 0;
 }
 
 //This should never be used in practice, but needs to exist so the compiler doesn't freak
@@ -104,8 +113,15 @@ CPU::CPU() {
     accumulator = 0;
 
     mem_map = 0;
+    cycle_count = 0;
+    cyc_cnt = 0;
 
     ppu = nullptr;
+    prg_rom = nullptr;
+    prg_rom_size = 0;
+    controllers = ControllerSnapshot();
+    controller_strobe = false;
+    controller_shift[0] = controller_shift[1] = 0;
 }
 
 // Used to reset the state of memory and other variables when a new ROM is loaded
@@ -118,6 +134,11 @@ void CPU::manual_reset() {
     xReg = 0;
     yReg = 0;
     accumulator = 0;
+    cycle_count = 0;
+    cyc_cnt = 0;
+    controllers = ControllerSnapshot();
+    controller_strobe = false;
+    controller_shift[0] = controller_shift[1] = 0;
 }
 
 // Gives the CPU a pointer to the PPU. This is mostly to expose the PPU registers to the CPU
@@ -125,6 +146,8 @@ void CPU::link_ppu(PPU* _ppu) { ppu = _ppu; }
 
 void CPU::delink_ppu() { ppu = nullptr; }
 
+unsigned long long CPU::get_cycle_count() const { return cycle_count; }
+
 //Decodes and executes instructions
 // Returns the number of cycles used by executing the instruction in full
 int CPU::decode() {
@@ -1104,7 +1127,11 @@ int CPU::decode() {
             throw std::invalid_argument("Error: Invalid opcode " + std::to_string(opcode) + " decoded");
     }
 
-    return cyc_cnt;
+    // cyc_cnt is cleared so that anything reading the bus between instructions (interrupts, debug logging) gets the right timestamp
+    int elapsed = cyc_cnt;
+    cycle_count += elapsed;
+    cyc_cnt = 0;
+    return elapsed;
 
 }
 
@@ -1692,9 +1719,10 @@ void CPU::PLP() {
 // Helper function to push the program counter to the stack
 void CPU::pushPC() {
     uint8_t high = programCounter >> 8;
-    uint8_t low = programCounter & 15;
-    write(0x100 + stackPointer, low);
-    write(0x100 + stackPointer - 1, high);
+    uint8_t low = programCounter & 0xFF;
+    // High byte goes on first so that RTI pops the low byte first
+    write(0x100 + stackPointer, high);
+    write(0x100 + stackPointer - 1, low);
     stackPointer -= 2;
 }
 
@@ -1873,6 +1901,8 @@ uint8_t CPU::read(uint16_t address) const {
         if (ppu == nullptr) {
             throw std::runtime_error("PPU not linked to CPU");
         }
+        // The PPU lags behind the CPU, so bring it up to date before looking at it
+        ppu->catch_up(cycle_count + cyc_cnt);
 
         uint8_t low = (address & 0x00FF) % 8;
         // Most of the PPU MMIO registers are write only and will cause some open bus behavior if the CPU tries to read them
@@ -1913,6 +1943,14 @@ uint8_t CPU::read(uint16_t address) const {
                 throw std::runtime_error("Somehow, low is a value that isn't between 00 and 07");
             }
     }
+    // Controllers - each read shifts out the next button, and once all 8 are out an official controller reads 1 from then on. The
+    // top bits are open bus, which is usually 0x40 from the address
+    else if (address == 0x4016 || address == 0x4017) {
+        int port = address & 1;
+        if (controller_strobe) controller_shift[port] = controllers.buttons[port];
+        val = 0x40 | (controller_shift[port] & 1);
+        controller_shift[port] = (controller_shift[port] >> 1) | 0x80;
+    }
     else {
         val = memory[address];
     }
@@ -1939,6 +1977,7 @@ void CPU::write(uint16_t address, uint8_t& val) {
         if (ppu == nullptr) {
             throw std::runtime_error("PPU not linked to CPU");
         }
+        ppu->catch_up(cycle_count + cyc_cnt);
 
         uint8_t low = (address & 0x00FF) % 8;
         switch (low) {
@@ -1988,9 +2027,24 @@ void CPU::write(uint16_t address, uint8_t& val) {
 
         uint8_t low = (address & 0x00FF) % 0x18;
         switch (low) {
-            // oamdma - writing here triggers a dma (a special memory transfer between cpu and ppu) and may require some additional code
+            // oamdma - writing here triggers a dma (a special memory transfer between cpu and ppu)
+            // The page 0xXX00 - 0xXXFF is copied into OAM. CPU memory is a flat array with the RAM mirrors already filled in, so
+            // the page can be handed straight to the PPU instead of going through read() byte by byte
+            // The CPU is halted for 513 cycles (1 wait cycle + 256 read/write pairs), plus one more if the DMA would begin on an
+            // odd cycle. The stall is charged to the instruction that did the write
             case 0x14:
+                ppu->catch_up(cycle_count + cyc_cnt);
                 ppu->set_oamdma(val);
+                ppu->oam_dma(&memory[(uint16_t) val << 8]);
+                cyc_cnt += 513 + ((cycle_count + cyc_cnt) & 1);
+                break;
+            // Controller strobe - the buttons get latched into both shift registers for as long as bit 0 is set
+            case 0x16:
+                controller_strobe = val & 1;
+                if (controller_strobe) {
+                    controller_shift[0] = controllers.buttons[0];
+                    controller_shift[1] = controllers.buttons[1];
+                }
                 break;
         }
     }
@@ -1998,9 +2052,11 @@ void CPU::write(uint16_t address, uint8_t& val) {
     else if (address <= 0x7FFF) {
         memory[address] = val;
     }
-    // Writing to ROM. Do memory mapper stuff
+    // Writing to ROM. Do memory mapper stuff - NES::load_rom turns down mappers without a handler, so a missing one only happens
+    // if the CPU was set up by hand, in which case there's nothing on the cartridge listening
     else {
-        (this->*writes[mem_map])(address, val);
+        auto handler = writes.find(mem_map);
+        if (handler != writes.end()) (this->*handler->second)(address, val);
     }
 }
 
@@ -2009,6 +2065,124 @@ void CPU::default_write(uint16_t address, uint8_t& val) {
     return;
 }
 
+// MMC3 (mapper 4). Registers are picked by the top 3 address bits and whether the address is odd or even
+// Bank switching changes what the PPU fetches and the IRQ registers change when the counter goes off, so the PPU is caught up first
+void CPU::mmc3_write(uint16_t address, uint8_t& val) {
+    ppu->catch_up(cycle_count + cyc_cnt);
+
+    bool odd = address & 1;
+    switch (address & 0xE000) {
+        // Bank select/bank data
+        // Games write these a lot, mostly just to pick the next register, so only the layout that actually changed gets remapped
+        case 0x8000:
+            if (!odd) {
+                uint8_t changed = mmc3.bank_select ^ val;
+                mmc3.bank_select = val;
+                if (changed & 0x40) mmc3_map_prg();
+                if (changed & 0x80) mmc3_map_chr();
+            }
+            else {
+                int reg = mmc3.bank_select & 7;
+                if (mmc3.banks[reg] == val) break;
+                mmc3.banks[reg] = val;
+                if (reg < 6) mmc3_map_chr();
+                else mmc3_map_prg();
+            }
+            break;
+        // Mirroring (cartridges with four screen VRAM ignore it)/PRG RAM protect, which we don't bother with
+        case 0xA000:
+            if (!odd && ppu->get_mirroring() != MIRROR_FOUR_SCREEN) ppu->set_mirroring((val & 1) ? MIRROR_HORIZONTAL : MIRROR_VERTICAL);
+            break;
+        // IRQ latch/reload
+        case 0xC000:
+            if (!odd) mmc3.counter.set_latch(val);
+            else mmc3.counter.set_reload();
+            ppu->predict_irq();
+            break;
+        // IRQ disable/enable
+        case 0xE000:
+            if (!odd) mmc3.counter.disable();
+            else mmc3.counter.enable();
+            ppu->predict_irq();
+            break;
+    }
+}
+
+// PRG is 4 slots of 8KB. R6 and R7 go in the first two and the last two banks are fixed, except bit 6 of bank select swaps the first
+// and third slots. Memory is a flat array, so switching a bank means copying it in
+void CPU::mmc3_map_prg() {
+    if (!prg_rom) return;
+    int count = prg_rom_size / 0x2000;
+    int slots[4] = {mmc3.banks[6] & 0x3F, mmc3.banks[7] & 0x3F, count - 2, count - 1};
+    if (mmc3.bank_select & 0x40) std::swap(slots[0], slots[2]);
+    for (int i = 0; i < 4; i++) std::memcpy(memory + 0x8000 + i * 0x2000, prg_rom + (slots[i] % count) * 0x2000, 0x2000);
+}
+
+// CHR is R0 and R1 as 2KB banks then R2 - R5 as 1KB banks, with bit 7 of bank select swapping the two pattern tables
+void CPU::mmc3_map_chr() {
+    int banks[8] = {mmc3.banks[0] & 0xFE, mmc3.banks[0] | 1, mmc3.banks[1] & 0xFE, mmc3.banks[1] | 1,
+                    mmc3.banks[2], mmc3.banks[3], mmc3.banks[4], mmc3.banks[5]};
+    int swap = (mmc3.bank_select & 0x80) ? 4 : 0;
+    for (int slot = 0; slot < 8; slot++) ppu->set_chr_bank(slot ^ swap, banks[slot]);
+}
+
+void CPU::set_prg_rom(const uint8_t* rom, size_t size) {
+    prg_rom = rom;
+    prg_rom_size = size;
+
+    if (mem_map == 4) {
+        mmc3 = MMC3();
+        mmc3.bank_select = 0;
+        const uint8_t banks[8] = {0, 2, 4, 5, 6, 7, 0, 1};
+        std::copy_n(banks, 8, mmc3.banks);
+        mmc3_map_prg();
+        mmc3_map_chr();
+    }
+}
+
+ScanlineCounter* CPU::get_scanline_counter() { return mem_map == 4 ? &mmc3.counter : nullptr; }
+
+void CPU::set_controllers(const ControllerSnapshot& snapshot) { controllers = snapshot; }
+
+const ControllerSnapshot& CPU::get_controllers() const { return controllers; }
+
+// Everything below 0x8000 goes in (RAM and its mirrors, the I/O registers as last written and cartridge RAM). Above that is PRG ROM,
+// which is either fixed or the mapper's banks, so it can be put back from the mapper's registers
+void CPU::save_state(StateWriter& out) const {
+    out.write(accumulator);
+    out.write(statusRegister);
+    out.write(programCounter);
+    out.write(stackPointer);
+    out.write(xReg);
+    out.write(yReg);
+    out.write(cycle_count);
+    out.write(cyc_cnt);
+    out.write(mmc3);
+    out.write(controllers);
+    out.write(controller_strobe);
+    out.write(controller_shift);
+    out.write_bytes(memory, 0x8000);
+}
+
+void CPU::load_state(StateReader& in) {
+    in.read(accumulator);
+    in.read(statusRegister);
+    in.read(programCounter);
+    in.read(stackPointer);
+    in.read(xReg);
+    in.read(yReg);
+    in.read(cycle_count);
+    in.read(cyc_cnt);
+    in.read(mmc3);
+    in.read(controllers);
+    in.read(controller_strobe);
+    in.read(controller_shift);
+    in.read_bytes(memory, 0x8000);
+    if (mem_map == 4) mmc3_map_prg();
+}
+
+bool CPU::irq_pending() const { return mem_map == 4 && mmc3.counter.irq_pending(); }
+
 // Interrupt handling functions
 
 // Reset interrupt which is triggered on system startup or whenever the reset button is pressed
@@ -2022,6 +2196,7 @@ int CPU::interrupt_reset() {
     stackPointer -= 3;
 
     programCounter = address;
+    cycle_count += 7;
 
     // Continue execution as normal;
     return 7;
@@ -2050,6 +2225,7 @@ int CPU::interrupt_IRQ_generic() {
     int8_t low = read(0xFFFE);
 
     programCounter = absAdd(low, high);
+    cycle_count += 7;
     return 7;
 }
 
@@ -2072,6 +2248,7 @@ int CPU::interrupt_NMI() {
     int8_t low = read(0xFFFA);
 
     programCounter = absAdd(low, high);
+    cycle_count += 7;
     return 7;
 }
 
@@ -2105,6 +2282,8 @@ void CPU::set_memMap(int memory_map) { mem_map = memory_map; }
 
 int CPU::get_memMap() const { return mem_map; }
 
+bool CPU::supports_mapper(int memory_map) const { return writes.count(memory_map) != 0; }
+
 void CPU::set_opcode(uint8_t op) { opcode = op; }
 
 uint8_t CPU::get_opcode() const { return opcode; }
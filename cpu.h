@@ -4,6 +4,7 @@
 #include <unordered_map>
 #include <memory>
 #include "ppu.h"
+#include "controller.h"
 
 //This class represents the CPU (duh). The NES used the Ricoh 2AO3 which was a slightly modified MOS 6502
 class CPU {
@@ -35,9 +36,21 @@ class CPU {
         //Like the X register but cannot affect the stack pointer
         uint8_t yReg;
         int mem_map;
+        // The whole of PRG ROM, for mappers that bank switch it into memory (the caller owns it)
+        const uint8_t* prg_rom;
+        uint32_t prg_rom_size;
+        // Mapper 4
+        MMC3 mmc3;
+        // Controllers - the buttons last handed over by the frontend, and the shift registers 0x4016/0x4017 read them out of.
+        // While strobe is set the shift registers keep reloading, so reads just return A. Reading shifts them, hence mutable
+        ControllerSnapshot controllers;
+        bool controller_strobe;
+        mutable uint8_t controller_shift[2];
         // Opcode and operand vars
         uint8_t opcode, high_nibble, low_nibble;
         int cyc_cnt;
+        // Total number of cycles elapsed - OAM DMA needs to know if it starts on an even or odd cycle
+        unsigned long long cycle_count;
         //This may or may not be necessary
 
         //Memory
@@ -116,9 +129,13 @@ class CPU {
 
         //Memory Map Write Functions - these will be used in place of the above ST* instructions
         void default_write(uint16_t address, uint8_t& val);
+        void mmc3_write(uint16_t address, uint8_t& val);
+        void mmc3_map_prg();
+        void mmc3_map_chr();
 
         std::unordered_map<int, void (CPU::*) (uint16_t address, uint8_t& val)> writes = {
-            {0, &CPU::default_write}
+            {0, &CPU::default_write},
+            {4, &CPU::mmc3_write}
         };
 
         void write(uint16_t address, uint8_t& val);
@@ -216,6 +233,8 @@ class CPU {
 
         void set_memMap(int memory_mapper);
         int get_memMap() const;
+        // Whether there's a write handler for this iNES mapper number - ROMs for any other mapper can't be run
+        bool supports_mapper(int memory_mapper) const;
 
         void set_opcode(uint8_t op);
         uint8_t get_opcode() const;
@@ -227,8 +246,23 @@ class CPU {
         uint8_t get_low_nibble() const;
 
         void link_ppu(PPU* _ppu);
+        // Hands over all of PRG ROM and puts the mapper's banks in their power on state - call after set_memMap and link_ppu
+        void set_prg_rom(const uint8_t* rom, size_t size);
+        // The mapper's A12 counter for the PPU to clock, or nullptr if it doesn't have one
+        ScanlineCounter* get_scanline_counter();
+        // Whether the cartridge is holding the IRQ line
+        bool irq_pending() const;
+        // Buttons held from now on, until the next call
+        void set_controllers(const ControllerSnapshot& snapshot);
+        const ControllerSnapshot& get_controllers() const;
+        // Registers, RAM and the mapper's registers, for save states (see state.h). PRG ROM isn't in the state - loading maps the
+        // saved banks back in from the ROM this CPU already has
+        void save_state(StateWriter& out) const;
+        void load_state(StateReader& in);
         void delink_ppu();
 
+        unsigned long long get_cycle_count() const;
+
         uint8_t get_next_low_nibble() const;
         uint8_t get_next_high_nibble() const;
         uint8_t get_next_opcode() const;
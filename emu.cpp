@@ -5,61 +5,73 @@
 #include <string>
 #include <chrono>
 #include <algorithm>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <cmath>
 
 std::string hex(uint32_t value, int width);
 
 Emulator::Emulator() {
     running = false;
+    frameskip = 1;
+    pipelined_rendering = false;
+    presented_hash = 0;
+    filter = FILTER_NONE;
+    filter_pending = false;
+    ntsc_output = false;
+    debug_viewer = false;
+    input_polls = 1;
+    keyboard_input = 0;
+    rewind_held = false;
+    quick_save_requested = false;
+    quick_load_requested = false;
+    fast_forward = false;
+    run_ahead = 0;
+    run_ahead_instance = false;
+    run_ahead_skip = 1;
+    run_ahead_skipped = 0;
+    rewind_seconds = 0;
+    rewinding = false;
+    movie_mode = MOVIE_NONE;
+    movie_frame = 0;
+    viewer_open = false;
+    viewer_window = nullptr;
+    viewer_renderer = nullptr;
+    viewer_texture = nullptr;
+    window = nullptr;
+    display_rate = 60;
+    title_changed = false;
+}
 
-    //Initialize PPU
-    ppu = PPU();
-
-    //Initialize APU
-    //apu = APU()
-
-    //Initialize CPU
-    cpu = CPU();
-    cpu.link_ppu(&ppu);
-
-    // SDL setup
+// SDL only gets set up once there's actually something to show, so the benchmarks and tests don't need a display
+bool Emulator::open_window() {
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
 
         printf("Error initializing SDL: %s\n", SDL_GetError());
-        throw std::runtime_error("");
+        return false;
 
     }
 
-    window = NULL;
-    renderer = NULL;
-
     window = SDL_CreateWindow("ShayNES", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, 0);
 
     if (window == NULL) {
 
         printf("Error creating SDL window: %s\n", SDL_GetError());
-        throw std::runtime_error("");
-
-    }
-
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-
-    if (renderer == NULL) {
-
-        printf("Error creating SDL renderer: %s\n", SDL_GetError());
-        throw std::runtime_error("");
+        SDL_Quit();
+        return false;
 
     }
 
-    SDL_RenderSetLogicalSize(renderer, LOGICAL_WIDTH, LOGICAL_HEIGHT);
-
-    // Create Texture
-    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, LOGICAL_WIDTH, LOGICAL_HEIGHT);
-
-    // Display a blank screen
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
-    SDL_RenderPresent(renderer);
+    // The renderer belongs to the presenter, which is set up once we know how big frames are
+    return true;
+}
 
+void Emulator::close_window() {
+    presenter.reset();
+    if (window) SDL_DestroyWindow(window);
+    window = nullptr;
+    SDL_Quit();
 }
 
 // Emulator::Emulator(const char * filename) {
@@ -204,216 +216,615 @@ Emulator::Emulator() {
 //     }
 // }
 
-void Emulator::run(const char * filename) {
-    running = false;
-    // Reset components to known state
-    cpu.manual_reset();
-    // ppu.manual_reset();
+void Emulator::set_frameskip(int n) { frameskip = n; }
 
-    //Load ROM
-    //Ripped from my CHIP 8 emulator
-    this->romFile.open(filename, std::ios::in | std::ios::binary | std::ios::ate);
+void Emulator::set_pipelined_rendering(bool enabled) { pipelined_rendering = enabled; }
 
-    if (romFile.is_open()) {
+void Emulator::set_filter(int filter) { this->filter = filter; }
 
-        unsigned int i = 0;
-        int size = romFile.tellg();
-        romFile.seekg(0, std::ios::beg);
+void Emulator::set_ntsc_output(bool enabled) { ntsc_output = enabled; }
 
-        //Parse file header
-        //Verify file is an ines file (first 4 bytes)
-        //Will need to throw an error gracefully
-        char byte;
+void Emulator::set_debug_viewer(bool open) { debug_viewer = open; }
 
-        romFile.read(&byte, 1);
+void Emulator::set_fast_forward(bool enabled) { fast_forward = enabled; }
 
-        if (byte != 'N') {
-
-        }
-
-        romFile.read(&byte, 1);
-        
-        if (byte != 'E') {
+void Emulator::set_run_ahead(int frames, bool second_instance) {
+    run_ahead = std::min(std::max(0, frames), 4);
+    run_ahead_instance = second_instance;
+}
 
-        }
+void Emulator::set_rewind(int seconds) { rewind_seconds = std::min(std::max(0, seconds), 600); }
 
-        romFile.read(&byte, 1);
+void Emulator::set_movie_record(const char * filename) {
+    movie_mode = MOVIE_RECORD;
+    movie_file = filename;
+}
 
-        if (byte != 'S') {
+void Emulator::set_movie_playback(const char * filename) {
+    movie_mode = MOVIE_PLAYBACK;
+    movie_file = filename;
+}
 
-        }
+void Emulator::set_input_polls(int per_frame) { input_polls = std::min(std::max(1, per_frame), 8); }
 
-        romFile.read(&byte, 1);
+void Emulator::run(const char * filename) {
+    running = false;
+    if (!nes.load_rom(filename) || !open_window()) return;
 
-        //End-of-file character
-        if (byte != 0x1A) {
+    // Only every nth frame gets drawn
+    nes.ppu.set_frameskip(frameskip);
 
-        }
+    // NTSC output works from the palette indices our PPU captures, so it can't be used with the render thread
+    if (ntsc_output && pipelined_rendering) {
+        std::cout << "NTSC output doesn't work with pipelined rendering - turning pipelined rendering off" << std::endl;
+        pipelined_rendering = false;
+    }
 
-        //Get the number of PRG-ROM banks
-        romFile.read(&byte, 1);
-        prg_rom = byte;
+    // Run-ahead rewinds the PPU every frame, which the render thread (replaying our register writes) can't follow
+    if (run_ahead && pipelined_rendering) {
+        std::cout << "Run-ahead doesn't work with pipelined rendering - turning pipelined rendering off" << std::endl;
+        pipelined_rendering = false;
+    }
+    // A movie has to go exactly the way it was recorded. Input is only recorded once a frame, and a state being loaded partway
+    // through (by rewinding) would make the rest of the input meaningless
+    if (movie_mode != MOVIE_NONE && rewind_seconds) {
+        std::cout << "Rewind doesn't work with movies - turning rewind off" << std::endl;
+        rewind_seconds = 0;
+    }
+    if (movie_mode != MOVIE_NONE && input_polls > 1) {
+        std::cout << "Movies only sample input once a frame - turning extra input polls off" << std::endl;
+        input_polls = 1;
+    }
+    // Playback starts by loading the movie's state, which the render thread can't follow
+    if (movie_mode == MOVIE_PLAYBACK && pipelined_rendering) {
+        std::cout << "Movie playback doesn't work with pipelined rendering - turning pipelined rendering off" << std::endl;
+        pipelined_rendering = false;
+    }
+    if (rewind_seconds && pipelined_rendering) {
+        std::cout << "Rewind doesn't work with pipelined rendering - turning pipelined rendering off" << std::endl;
+        pipelined_rendering = false;
+    }
 
-        //Get the number of CHR-ROM banks
-        romFile.read(&byte, 1);
-        chr_rom = byte;
+    // With pipelined rendering, our PPU never draws anything - it just logs register accesses for the render thread, which
+    // does the drawing on another core
+    if (pipelined_rendering) {
+        render_thread = std::make_unique<PPURenderThread>(nes.ppu);
+        nes.ppu.set_frameskip(0);
+        nes.ppu.set_write_log(render_thread->get_log());
+        render_thread->start();
+    }
 
-        //Parse header flags
-        //This will be done later in more depth
-        romFile.read(&byte, 1);
-        flag6 = byte;
+    // Perform reset interrupt
+    nes.reset();
+    running = true;
 
-        romFile.read(&byte, 1);
-        flag7 = byte;
+    movie_frame = 0;
+    if (movie_mode == MOVIE_RECORD) {
+        movie = std::make_unique<Movie>();
+        movie->start_recording(nes);
+    }
+    else if (movie_mode == MOVIE_PLAYBACK) {
+        movie = std::make_unique<Movie>();
+        if (!movie->load(movie_file.c_str()) || !movie->start_playback(nes)) movie.reset();
+    }
 
-        //flags 8-10 are rarely used, bytes 11-15 are unused padding, so just jump to byte 16
+    // Nothing has been presented yet, so start off with a hash that differs from the PPU's
+    presented_hash = ~nes.ppu.get_frame_hash();
+
+    // With NTSC output, the PPU draws into its own frame buffer (which is only used for the frame hash) and captures palette
+    // indices for the filter, which decodes them into frames twice as wide
+    filter_pending = false;
+    int width = 256, height = 240;
+    if (ntsc_output) {
+        ntsc_filter = std::make_unique<NtscFilter>();
+        ntsc_indices.assign(256 * 240, 0x0F);
+        nes.ppu.set_index_target(ntsc_indices.data());
+        width = NtscFilter::WIDTH;
+        height = NtscFilter::HEIGHT;
+    }
+    // With a filter, the PPU draws into the filter's input buffers and the filter's output goes to the presenter
+    else if (get_filter_info(filter)) {
+        filter_pipeline = std::make_unique<FilterPipeline>(filter, std::max(1, (int) std::thread::hardware_concurrency() / 2));
+        width = filter_pipeline->get_width();
+        height = filter_pipeline->get_height();
+        if (!render_thread) nes.ppu.set_frame_target(filter_pipeline->get_input(), 256 * 4);
+    }
+    presenter = std::make_unique<FramePresenter>(window, width, height);
 
-        //Load everything into memory based on memory mapper
-        //The mapper we use is determined by an 8 bit number whose lower nibble is the upper nibble of flag6 and whose upper nibble is the
-        //upper nibble of flag7
-        //For now, assume no mapper
-        int mapperNum = (flag7 & 0xF0) | (flag6 >> 4);
+    // The second instance publishes its frames straight to the presenter, so there's no room for a filter in between
+    if (run_ahead && run_ahead_instance && (ntsc_filter || filter_pipeline)) {
+        std::cout << "Second instance run-ahead doesn't work with filters - running ahead on this thread instead" << std::endl;
+        run_ahead_instance = false;
+    }
+    // Rewound frames are drawn by our PPU, which the second instance would otherwise leave with nowhere to draw
+    if (run_ahead && run_ahead_instance && rewind_seconds) {
+        std::cout << "Second instance run-ahead doesn't work with rewind - running ahead on this thread instead" << std::endl;
+        run_ahead_instance = false;
+    }
+    // With the second instance doing all the drawing, our PPU never draws anything
+    if (run_ahead && run_ahead_instance) {
+        run_ahead_worker = std::make_unique<RunAheadWorker>(presenter.get(), nes);
+        nes.ppu.set_frameskip(0);
+    }
+    else if (run_ahead) run_ahead_state.resize(nes.get_state_size());
 
-        //Set CPU memory mapper
-        cpu.set_memMap(mapperNum);
-        
-        // Instead of using OOP principles to implement mappers, each mapper will have a write function stored in a table
+    // Without the render thread, the PPU draws straight into the presenter's back buffer
+    if (!ntsc_filter && !filter_pipeline && !render_thread && !run_ahead_worker) {
+        nes.ppu.set_frame_target(presenter->get_back_buffer(), presenter->get_pitch());
+    }
+    if (debug_viewer) open_viewer();
 
-        // Check for trainer; low-key don't know what to do if there is one in terms of writing to memory, so will just skip the trainer
-        // if there is one for now
+    // A minute of Donkey Kong takes up under 2MB, so this leaves plenty of room. Games whose states don't compress as well just
+    // lose their oldest history early
+    if (rewind_seconds) {
+        rewind_state.resize(nes.get_state_size());
+        rewind = std::make_unique<RewindBuffer>(rewind_state.size(), (int) (rewind_seconds * FRAME_RATE), rewind_seconds * 64 * 1024);
+    }
+    rewinding = false;
+    run_ahead_skip = 1;
+    run_ahead_skipped = 0;
+    state_file = std::string(filename) + ".state";
+    quick_state.resize(nes.get_state_size());
+
+    // Fast forward tries to keep what it draws down to about the display's refresh rate (see emulation_loop)
+    SDL_DisplayMode mode;
+    if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) == 0 && mode.refresh_rate > 0) {
+        display_rate = mode.refresh_rate;
+    }
 
-        if ((flag6 & 4) == 4) {
-            romFile.seekg(528);
-        }
-        else {
-            romFile.seekg(16);
+    // SDL only works from the thread that set it up, so this one handles events and puts frames on screen while emulation gets
+    // a thread of its own. Nothing can be shown without a renderer, so there's no point starting emulation without one
+    std::thread emulation;
+    if (presenter->has_failed()) running = false;
+    else emulation = std::thread(&Emulator::emulation_loop, this);
+    while (running) {
+        handle_events();
+        // Frames that are the same as the last one never get published (see present_frame), so this wakes up every few
+        // milliseconds regardless to keep input and window events flowing on static screens
+        presenter->wait_for_frame(std::chrono::milliseconds(4));
+        presenter->present();
+        if (viewer) show_viewer();
+
+        std::lock_guard<std::mutex> lock(title_mutex);
+        if (title_changed) {
+            SDL_SetWindowTitle(window, window_title.c_str());
+            title_changed = false;
         }
+    }
+    if (emulation.joinable()) emulation.join();
+
+    if (render_thread) {
+        render_thread->stop();
+        render_thread.reset();
+        nes.ppu.set_write_log(nullptr);
+    }
+    else if (filter_pipeline) filter_pipeline->wait();
+    filter_pipeline.reset();
+    run_ahead_worker.reset();
+    run_ahead_state.clear();
+    rewind.reset();
+    if (movie && movie_mode == MOVIE_RECORD) {
+        movie->finish_recording(nes);
+        if (movie->save(movie_file.c_str())) std::cout << "Recorded " << movie->get_frames() << " frames to " << movie_file << std::endl;
+    }
+    movie.reset();
+    ntsc_filter.reset();
+    nes.ppu.set_frame_target(nullptr, 0);
+    nes.ppu.set_index_target(nullptr);
+    close_viewer();
+    close_window();
+}
 
-        // Read in the initial PRG-ROM into the CPU - varies based on mapper
-        // May need to re-engineer this later but this shall do for having no mapper probably
+// Runs on its own thread from run() until running is cleared. Everything the core does happens here - SDL is left to the thread
+// that called run, which this only talks to through the presenter, the input it samples and a few flags
+void Emulator::emulation_loop() {
+    // Frames are paced against a fixed starting point - each one is due a whole number of frame times after it, so sleeping
+    // a little long for one frame just means a shorter sleep for the next instead of the error piling up
+    using Clock = std::chrono::steady_clock;
+    const Clock::duration frame_time = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1 / FRAME_RATE));
+    Clock::time_point pace_start = Clock::now();
+    unsigned long long paced_frames = 0;
+    PacingStats stats;
+
+    // Fast forward just drops the pacing. Drawing (and filtering and presenting) frames nobody will see would eat into the speedup,
+    // so the PPU skips frames to stay at about the display's refresh rate. The skip gets adjusted a couple of times a second
+    bool was_fast_forward = false;
+    Clock::time_point speed_start = Clock::now();
+    int speed_frames = 0;
 
-        // Mirror the rom bank
-        if (prg_rom == 1) {
-            for (int i = 0; i < 16000; i++) {
-                romFile.read(&byte, 1);
-                cpu.memory[0x8000 + i] = byte;
-                cpu.memory[0xC000 + i] = byte;
+    while (running) {
+        // Saving and loading go between frames, so a state never has half a frame's input in it
+        if (quick_save_requested.exchange(false)) quick_save();
+        if (quick_load_requested.exchange(false)) quick_load();
+        poll_input();
+        rewinding = rewind_held;
+        if (movie) step_movie();
+
+        Clock::time_point busy_start = Clock::now();
+        if (rewinding && rewind) rewind_frame();
+        else if (run_ahead) run_frame_ahead();
+        else {
+            // Input can be sampled a few times a frame as well, for games that read the controllers more than once a frame. The
+            // frame is split into equal parts by CPU cycles - the last part is whatever's left until vblank
+            for (int poll = 1; poll < input_polls && running; poll++) {
+                nes.run_cycles(29781 / input_polls);
+                poll_input();
             }
+            nes.run_frame();
+            // That's the end of the visible part of the frame, so the render thread can hand it over once it gets here
+            if (render_thread) render_thread->end_frame(nes.ppu.get_sync_cycle());
+            present_frame();
         }
-        // Load first two banks into memory otherwise
-        else {
-            for (int i = 0; i < 32000; i++) {
-                romFile.read(&byte, 1);
-                cpu.memory[0x8000 + i] = byte;
+        // Each frame's state goes into the history as it's finished
+        if (rewind && !rewinding) {
+            nes.save_state(rewind_state.data(), rewind_state.size());
+            rewind->push(rewind_state.data());
+        }
+        if (viewer_open) update_viewer();
+        Clock::time_point busy_end = Clock::now();
+
+        // The SDL thread can toggle this at any point, so it's only looked at once a frame
+        bool fast = fast_forward;
+        if (fast != was_fast_forward) {
+            was_fast_forward = fast;
+            speed_start = busy_end;
+            speed_frames = 0;
+            if (!fast) {
+                if (run_ahead) run_ahead_skip = 1;
+                else if (!render_thread) nes.ppu.set_frameskip(frameskip);
+                set_title("ShayNES");
+                std::cout << "Fast forward off" << std::endl;
+                // Start pacing from here, rather than trying to get back to where we'd have been
+                pace_start = busy_end;
+                paced_frames = 0;
+                stats = PacingStats();
             }
         }
 
-        // Read CHR-ROM
-        // CHR-ROM is used by the PPU to fill the pattern table, some mappers/games handle pattern tables differently and may
-        // need to account for that
-        // If CHR ROM is 0, CHR RAM is used
-        if (chr_rom != 0) {
-            // NEEDS TO BE REPLACED LATER
-            for (int i = 0; i < 0x2000; i++) {
-                romFile.read(&byte, 1);
-                ppu.memory[i] = byte;
+        if (fast) {
+            speed_frames++;
+            double seconds = std::chrono::duration<double>(busy_end - speed_start).count();
+            if (seconds >= 0.5) {
+                double fps = speed_frames / seconds;
+                // The render thread draws every frame regardless, so there's nothing to skip on our side. Run-ahead draws its
+                // speculative frames rather than the real ones, so it does its own skipping (see run_frame_ahead)
+                int skip = std::max(frameskip, (int) std::lround(fps / display_rate));
+                if (run_ahead) run_ahead_skip = std::max(1, skip);
+                else if (!render_thread) nes.ppu.set_frameskip(skip);
+
+                std::ostringstream speed;
+                speed << std::fixed << std::setprecision(1) << fps / FRAME_RATE << "x";
+                set_title("ShayNES - fast forward " + speed.str());
+                std::cout << "Fast forward: " << speed.str() << " (" << (int) fps << " fps)" << std::endl;
+                speed_start = busy_end;
+                speed_frames = 0;
             }
-            //romFile.seekg(8192 * chr_rom, std::ios::cur);
+            continue;
         }
 
-        // Lastly, there's PlayChoice ROM which is kinda niche, but will deal with anyway
-        // If the 1st bit of flag 7 is set, there's 8KB of additional data to read called INST ROM as well as
-        // 16 bytes of PROM Data output used to decrypt the INST and 16 bytes of PROM CounterOut output used similarly which is sometimes ignored
-        if (flag7 & 2 == 2) {
-            // NEEDS TO BE REPLACED LATER
-            romFile.seekg(8192, std::ios::cur);
+        // Sleep off whatever's left of the frame. The OS tends to oversleep by a bit, so the last millisecond is spent yielding
+        paced_frames++;
+        Clock::time_point deadline = pace_start + paced_frames * frame_time;
+        if (busy_end < deadline) {
+            std::this_thread::sleep_until(deadline - std::chrono::milliseconds(1));
+            while (Clock::now() < deadline) std::this_thread::yield();
+        }
+        Clock::time_point frame_end = Clock::now();
+
+        stats.frames++;
+        stats.busy += busy_end - busy_start;
+        double error = std::chrono::duration<double, std::milli>(frame_end - deadline).count();
+        stats.total_error += std::abs(error);
+        stats.max_error = std::max(stats.max_error, std::abs(error));
+
+        // If we've fallen well behind (the machine is too slow, we got swapped out for a while, etc.), trying to catch up would
+        // mean running flat out for a while, so start counting from here instead
+        if (frame_end - deadline > 4 * frame_time) {
+            pace_start = frame_end;
+            paced_frames = 0;
+            stats.resyncs++;
         }
 
-        // May be an additional bit of data at the end of file but it can be safely ignored
+        if (frame_end - stats.start >= std::chrono::seconds(5)) {
+            report_pacing(stats, frame_end);
+            stats = PacingStats();
+            stats.start = frame_end;
+        }
+    }
+}
 
-        // Can now begin execution
+// Run-ahead: the real frame is run without being drawn, then its state is saved, a few more frames are run with the same input
+// and only the last of them is shown, and then the state is put back. What's on screen is run_ahead frames further along than the
+// game really is, which hides that many frames of the game's own input lag. Input is only sampled once a frame with this on
+// While fast forwarding only every run_ahead_skip-th frame is shown, and since running ahead changes nothing but what's shown, the
+// rest don't run ahead at all
+void Emulator::run_frame_ahead() {
+    nes.ppu.set_frameskip(0);
+    nes.run_frame();
+    if (++run_ahead_skipped < run_ahead_skip) return;
+    run_ahead_skipped = 0;
+    if (run_ahead_worker) {
+        run_ahead_worker->submit(nes, run_ahead);
+        return;
+    }
 
-        // Perform reset interrupt
-        long long cycles = 0;
-        cycles += cpu.interrupt_reset();
-        running = true;
+    nes.save_state(run_ahead_state.data(), run_ahead_state.size());
+    for (int i = 1; i < run_ahead; i++) nes.run_frame();
+    nes.ppu.set_frameskip(1);
+    nes.run_frame();
+    present_frame();
+    nes.load_state(run_ahead_state.data(), run_ahead_state.size());
+}
 
-        // Code execution -- need to add timing and some simulation of concurrency, but this should work for testing the CPU
-        int cycle_delta = 0;
-        auto last_time = std::chrono::high_resolution_clock::now();
+// Steps back a frame. The states in the history are from the end of each frame, so the frame after the one taken off is run again
+// to draw it - with the input it had the first time, since that's part of the state. Once there's no history left, this just
+// stays on the oldest frame. The PPU's frameskip is put back the way it was afterwards, since fast forward and run-ahead change it
+// from the configured one
+void Emulator::rewind_frame() {
+    if (!rewind->pop(rewind_state.data())) return;
+    nes.load_state(rewind_state.data(), rewind_state.size());
+    int skip = nes.ppu.get_frameskip();
+    nes.ppu.set_frameskip(1);
+    nes.run_frame();
+    present_frame();
+    nes.ppu.set_frameskip(skip);
+}
 
-        while (running) {
-            //Allows user to close window
-            SDL_Event event;
-            while (SDL_PollEvent(&event)) {
+// Saving the state doesn't allocate anything - only writing the file out does
+void Emulator::quick_save() {
+    size_t size = nes.save_state(quick_state.data(), quick_state.size());
+    std::ofstream file(state_file, std::ios::binary | std::ios::trunc);
+    if (size == 0 || !file.write(reinterpret_cast<const char *>(quick_state.data()), size)) {
+        std::cout << "Error: couldn't save the state to " << state_file << std::endl;
+        return;
+    }
+    std::cout << "Saved the state to " << state_file << std::endl;
+}
 
-                switch(event.type) {
+void Emulator::quick_load() {
+    if (movie) {
+        std::cout << "States can't be loaded while a movie is being recorded or played" << std::endl;
+        return;
+    }
+    // The render thread replays our PPU's register writes, so it can't follow the PPU jumping to another state
+    if (render_thread) {
+        std::cout << "States can't be loaded with pipelined rendering on" << std::endl;
+        return;
+    }
+    std::ifstream file(state_file, std::ios::binary);
+    if (!file.is_open()) {
+        std::cout << "Error: there's no state to load at " << state_file << std::endl;
+        return;
+    }
+    // A file that's too big just gets cut off here, and then turned away for not matching the size in its header
+    file.read(reinterpret_cast<char *>(quick_state.data()), quick_state.size());
+    if (nes.load_state(quick_state.data(), file.gcount())) std::cout << "Loaded the state from " << state_file << std::endl;
+}
 
-                    case SDL_QUIT:
-                        running = false;
-                        break;
-        
-                }
+// Called once a frame, before it's run. Recording takes the input the frame is about to run with, and playback swaps the keyboard's
+// input for what was recorded
+void Emulator::step_movie() {
+    if (movie_mode == MOVIE_RECORD) {
+        movie->record_frame(nes.cpu.get_controllers());
+        return;
+    }
+    if (movie_frame < movie->get_frames()) {
+        nes.cpu.set_controllers(movie->get_input(movie_frame++));
+        return;
+    }
 
-            }
+    // Every recorded frame has been run, so we should be in exactly the state recording finished in
+    bool matches = Movie::hash_state(nes) == movie->get_final_hash();
+    std::cout << "Movie finished after " << movie_frame << " frames - the final state " << (matches ? "matches" : "DOESN'T MATCH")
+              << " the recording" << std::endl;
+    movie.reset();
+}
 
-            auto current_time = std::chrono::high_resolution_clock::now();
-            //auto ld = std::chrono::duration<long double>(current_time - last_time);
-            auto diff = std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(current_time - last_time).count();
-
-            if (diff > clock_speed * cycle_delta) {
-                double render_diff = diff * 10e-6;
-                // Check to see if we need to update the screen
-                if (render_diff > render_speed) {
-                    uint8_t* locked_pixels = nullptr;
-                    int pitch = 0;
-                    SDL_LockTexture(texture, NULL, reinterpret_cast<void **>(&locked_pixels), &pitch);
-                    std::copy_n(ppu.frame_buffer, LOGICAL_WIDTH * LOGICAL_HEIGHT * 4, locked_pixels);
-                    SDL_UnlockTexture(texture);
-
-                    // Render the new pixel data
-                    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
-                    SDL_RenderPresent(renderer);
-                }
+// Runs on the SDL thread (see run). Handles window events, then samples the keyboard for emulation to pick up with poll_input
+void Emulator::handle_events() {
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
 
-                last_time = current_time;
+        switch(event.type) {
 
-                cycle_delta = cpu.decode();
+            case SDL_QUIT:
+                running = false;
+                break;
 
-                // Check for NMI being triggered
-                if (ppu.nmi_trigger) cycle_delta += cpu.interrupt_NMI();
+            // With the viewer open there are two windows, so closing one of them doesn't quit on its own
+            case SDL_WINDOWEVENT:
+                if (event.window.event == SDL_WINDOWEVENT_CLOSE) {
+                    if (viewer_window && event.window.windowID == SDL_GetWindowID(viewer_window)) close_viewer();
+                    else running = false;
+                }
+                break;
 
-                // Run ppu the necessary number of cycles
-                for (int i = 0; i < cycle_delta; i++) {
-                    ppu.tick();
-                    // Check for NMI
-                    if (ppu.nmi_trigger) cycle_delta += cpu.interrupt_NMI();
+            case SDL_KEYDOWN:
+                if (event.key.keysym.sym == SDLK_F1 && !event.key.repeat) {
+                    if (viewer) close_viewer();
+                    else open_viewer();
                 }
+                if (event.key.keysym.sym == SDLK_TAB && !event.key.repeat) fast_forward = !fast_forward;
+                if (event.key.keysym.sym == SDLK_F5 && !event.key.repeat) quick_save_requested = true;
+                if (event.key.keysym.sym == SDLK_F9 && !event.key.repeat) quick_load_requested = true;
+                break;
 
-                cycles += cycle_delta;
-            }
         }
 
-        romFile.close();
+    }
+
+    // Controller 1 is on the keyboard - X and Z are A and B, Enter is start and right shift is select. Nothing is mapped to
+    // controller 2 yet
+    static const struct { SDL_Scancode key; uint8_t button; } keys[] = {
+        {SDL_SCANCODE_X, BUTTON_A}, {SDL_SCANCODE_Z, BUTTON_B}, {SDL_SCANCODE_RSHIFT, BUTTON_SELECT},
+        {SDL_SCANCODE_RETURN, BUTTON_START}, {SDL_SCANCODE_UP, BUTTON_UP}, {SDL_SCANCODE_DOWN, BUTTON_DOWN},
+        {SDL_SCANCODE_LEFT, BUTTON_LEFT}, {SDL_SCANCODE_RIGHT, BUTTON_RIGHT}
+    };
+    const Uint8* keyboard = SDL_GetKeyboardState(nullptr);
+    uint8_t buttons = 0;
+    for (const auto& key : keys) {
+        if (keyboard[key.key]) buttons |= key.button;
+    }
+    // Holding opposite directions at once isn't possible on a real controller, and some games break if it happens
+    if ((buttons & (BUTTON_UP | BUTTON_DOWN)) == (BUTTON_UP | BUTTON_DOWN)) buttons &= ~(BUTTON_UP | BUTTON_DOWN);
+    if ((buttons & (BUTTON_LEFT | BUTTON_RIGHT)) == (BUTTON_LEFT | BUTTON_RIGHT)) buttons &= ~(BUTTON_LEFT | BUTTON_RIGHT);
+    keyboard_input = buttons;
+    rewind_held = keyboard[SDL_SCANCODE_BACKSPACE];
+}
+
+// Hands the keyboard's latest state to the core. Called at frame boundaries (and a few times during a frame if set_input_polls
+// asks for it) - the core only ever sees input change between frames. The keyboard only gets sampled as often as the SDL thread
+// comes round, which is at least once a display refresh
+void Emulator::poll_input() {
+    uint16_t buttons = keyboard_input;
+    ControllerSnapshot input = {};
+    input.buttons[0] = (uint8_t) buttons;
+    input.buttons[1] = (uint8_t) (buttons >> 8);
+    nes.cpu.set_controllers(input);
+}
+
+void Emulator::set_title(const std::string& title) {
+    std::lock_guard<std::mutex> lock(title_mutex);
+    window_title = title;
+    title_changed = true;
+}
+
+// How far frames landed from their deadlines, how much of the time was spent actually emulating, and how far we've drifted from
+// where a real NES would be
+void Emulator::report_pacing(const PacingStats& stats, std::chrono::steady_clock::time_point now) {
+    if (stats.frames == 0) return;
+    double wall = std::chrono::duration<double>(now - stats.start).count();
+    double busy = std::chrono::duration<double>(stats.busy).count();
+    double drift = 1000 * (wall - stats.frames / FRAME_RATE);
+    std::cout << std::fixed << std::setprecision(2) << "Pacing: " << stats.frames / wall << " fps, frame error avg "
+              << stats.total_error / stats.frames << " ms max " << stats.max_error << " ms, drift " << drift << " ms, CPU "
+              << 100 * busy / wall << "%";
+    if (stats.resyncs) std::cout << ", fell behind " << stats.resyncs << " times";
+    if (rewind) {
+        std::cout << ", rewind " << rewind->get_frames() / FRAME_RATE << " s kept in " << rewind->get_bytes_used() / 1024 << " KB ("
+                  << rewind->get_bytes_per_minute() / (1024 * 1024) << " MB a minute)";
+    }
+    if (presenter->get_frames_dropped()) std::cout << ", " << presenter->get_frames_dropped() << " frames dropped by the presenter";
+    std::cout << std::defaultfloat << std::endl;
+}
+
+// Called at the start of vblank, when the visible part of a frame is done. Whatever ends up in the presenter's back buffer gets
+// published, and the SDL thread puts it on screen in its own time (see run)
+// A lot of frames (title screens, pauses, etc.) are exactly the same as the one before, in which case there's nothing to publish.
+// The render thread already holds back duplicates, otherwise we go by the PPU's frame hash
+void Emulator::present_frame() {
+    if (ntsc_filter) {
+        // Dot crawl shifts the whole picture every other frame, so a frame is only the same as the last one shown if its phase is
+        // too - otherwise static screens would freeze on one phase, which is where the crawl shows up most
+        uint64_t hash = nes.ppu.get_frame_hash() ^ (nes.ppu.get_frame_count() & 1);
+        if (hash == presented_hash) return;
+        presented_hash = hash;
+        ntsc_filter->filter(ntsc_indices.data(), presenter->get_back_buffer(), presenter->get_pitch(), nes.ppu.get_frame_count());
+        presenter->publish();
+        return;
+    }
+
+    if (filter_pipeline) {
+        if (render_thread) {
+            if (!render_thread->copy_frame(filter_pipeline->get_input(), 256 * 4)) return;
+        }
+        else {
+            if (nes.ppu.get_frame_hash() == presented_hash) return;
+            presented_hash = nes.ppu.get_frame_hash();
+        }
+
+        // The last frame has been getting filtered into the back buffer while this one was emulated, so it's the one that gets
+        // published now. This one gets filtered while the next one is emulated
+        if (filter_pending) {
+            filter_pipeline->wait();
+            presenter->publish();
+        }
+
+        filter_pipeline->submit(presenter->get_back_buffer(), presenter->get_pitch());
+        filter_pending = true;
+        // The PPU moves on to the other input buffer
+        if (!render_thread) nes.ppu.set_frame_target(filter_pipeline->get_input(), 256 * 4);
+        return;
+    }
+
+    if (render_thread) {
+        if (!render_thread->copy_frame(presenter->get_back_buffer(), presenter->get_pitch())) return;
     }
     else {
+        if (nes.ppu.get_frame_hash() == presented_hash) return;
+        presented_hash = nes.ppu.get_frame_hash();
+    }
+    presenter->publish();
 
-        std::cout << "Error: ROM could not be opened. Please make sure the file path is correct." << std::endl;
+    // The back buffer is a different one now, and has an older frame in it - that's fine, since every pixel gets drawn again
+    if (!render_thread) nes.ppu.set_frame_target(presenter->get_back_buffer(), presenter->get_pitch());
+}
 
+void Emulator::open_viewer() {
+    if (viewer) return;
+    viewer_window = SDL_CreateWindow("ShayNES - PPU", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, PPUViewer::WIDTH,
+                                     PPUViewer::HEIGHT, 0);
+    if (viewer_window == NULL) {
+        printf("Error creating viewer window: %s\n", SDL_GetError());
+        return;
     }
+    viewer_renderer = SDL_CreateRenderer(viewer_window, -1, 0);
+    viewer_texture = SDL_CreateTexture(viewer_renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, PPUViewer::WIDTH,
+                                       PPUViewer::HEIGHT);
+    std::lock_guard<std::mutex> lock(viewer_mutex);
+    viewer = std::make_unique<PPUViewer>();
+    viewer_open = true;
+}
+
+void Emulator::close_viewer() {
+    if (!viewer) return;
+    {
+        std::lock_guard<std::mutex> lock(viewer_mutex);
+        viewer_open = false;
+        viewer.reset();
+        viewer_snapshot.reset();
+    }
+    SDL_DestroyTexture(viewer_texture);
+    SDL_DestroyRenderer(viewer_renderer);
+    SDL_DestroyWindow(viewer_window);
+    viewer_texture = nullptr;
+    viewer_renderer = nullptr;
+    viewer_window = nullptr;
+}
+
+// Called by emulation once a frame while the viewer is open. The viewer thread decodes the snapshot in the background
+void Emulator::update_viewer() {
+    std::lock_guard<std::mutex> lock(viewer_mutex);
+    if (viewer) viewer->publish(nes.ppu, viewer_snapshot);
+}
+
+// Shows whatever the viewer thread has finished since last time. SDL has to be driven from the thread that set it up, so the
+// upload happens there rather than in update_viewer
+void Emulator::show_viewer() {
+    // Locking the texture means uploading whatever ends up in it, so don't unless there's something to put there. Only get_image
+    // takes the image back off the viewer, so it's still there once we've locked
+    if (!viewer->has_new_image()) return;
+
+    uint8_t* locked_pixels = nullptr;
+    int pitch = 0;
+    SDL_LockTexture(viewer_texture, NULL, reinterpret_cast<void **>(&locked_pixels), &pitch);
+    viewer->get_image(locked_pixels, pitch);
+    SDL_UnlockTexture(viewer_texture);
+    SDL_RenderCopy(viewer_renderer, viewer_texture, nullptr, nullptr);
+    SDL_RenderPresent(viewer_renderer);
 }
 
 // Function that just runs Kevin Horton's nestest in automation mode and creates a log file
 void Emulator::nes_test() {
     running = false;
-    cpu.manual_reset();
+    nes.cpu.manual_reset();
 
     this->romFile.open("nestest.nes", std::ios::in | std::ios::binary | std::ios::ate);
     std::ifstream good_log;
     good_log.open("nestest good log.txt");
     
     // Set the program counter to 0xC000 to run in automation mode
-    cpu.set_PC(0xC000);
+    nes.cpu.set_PC(0xC000);
 
     // Load the test ROM
     // Skip header for now
@@ -421,10 +832,10 @@ void Emulator::nes_test() {
     char byte;
 
     // Load the test into ROM
-    for (int i = 0; i < 16000; i++) {
+    for (int i = 0; i < 16384; i++) {
         romFile.read(&byte, 1);
-        cpu.memory[0x8000 + i] = byte;
-        cpu.memory[0xC000 + i] = byte;
+        nes.cpu.memory[0x8000 + i] = byte;
+        nes.cpu.memory[0xC000 + i] = byte;
     }
 
     // Create log file
@@ -691,24 +1102,24 @@ void Emulator::nes_test() {
         lines++;
         std::getline(good_log, line);
         // Log state of registers, PC, etc before instruction is decoded
-        uint16_t pcint = cpu.get_PC();
+        uint16_t pcint = nes.cpu.get_PC();
         pc  = hex(pcint, 4);
-        acc = hex(cpu.get_accumulator(), 2);
-        sp  = hex(cpu.get_stack(), 2);
-        p   = hex(cpu.get_status(), 2);
-        x   = hex(cpu.get_x(), 2);
-        y   = hex(cpu.get_y(), 2);
+        acc = hex(nes.cpu.get_accumulator(), 2);
+        sp  = hex(nes.cpu.get_stack(), 2);
+        p   = hex(nes.cpu.get_status(), 2);
+        x   = hex(nes.cpu.get_x(), 2);
+        y   = hex(nes.cpu.get_y(), 2);
 
         // Log values of opcode and operands
-        op = hex(cpu.get_next_opcode(), 2);
-        hi  = hex(cpu.get_next_high_nibble(), 2);
-        low = hex(cpu.get_next_low_nibble(), 2);
+        op = hex(nes.cpu.get_next_opcode(), 2);
+        hi  = hex(nes.cpu.get_next_high_nibble(), 2);
+        low = hex(nes.cpu.get_next_low_nibble(), 2);
 
         // Write to log file
         test_log << pc << std::setw(4);
         // Next part is opcode dependent
         test_log << op;
-        int op_int = cpu.get_next_opcode();
+        int op_int = nes.cpu.get_next_opcode();
         if (pcIncrement[op_int] == 1) {
             test_log << std::setw(11);
         }
@@ -736,55 +1147,55 @@ void Emulator::nes_test() {
                 test_log << " #$" << low << std::setw(26);
                 break;
             case AddressingMode::ZP:
-                test_log << " $" << low << " = " << hex(cpu.memory[cpu.get_next_low_nibble()], 2) << std::setw(22);
+                test_log << " $" << low << " = " << hex(nes.cpu.memory[nes.cpu.get_next_low_nibble()], 2) << std::setw(22);
                 break;
             case AddressingMode::ZPX:
-                exp = (cpu.get_next_low_nibble() + cpu.get_x()) & 0xFF;
-                test_log << " $" << low << ",X @ " << hex(exp, 2) << " = " << hex(cpu.memory[exp], 2) << std::setw(15);
+                exp = (nes.cpu.get_next_low_nibble() + nes.cpu.get_x()) & 0xFF;
+                test_log << " $" << low << ",X @ " << hex(exp, 2) << " = " << hex(nes.cpu.memory[exp], 2) << std::setw(15);
                 break;
             case AddressingMode::ZPY:
-                exp = (cpu.get_next_low_nibble() + cpu.get_y()) & 0xFF;
-                test_log << " $" << low << ",Y @ " << hex(exp, 2) << " = " << hex(cpu.memory[exp], 2) << std::setw(15);
+                exp = (nes.cpu.get_next_low_nibble() + nes.cpu.get_y()) & 0xFF;
+                test_log << " $" << low << ",Y @ " << hex(exp, 2) << " = " << hex(nes.cpu.memory[exp], 2) << std::setw(15);
                 break;
             case AddressingMode::JSR:
                 test_log << " $" << hi << low << std::setw(25);
                 break;
             case AddressingMode::ABSX:
-                exp = ((((uint16_t) cpu.get_next_high_nibble()) << 8) | cpu.get_next_low_nibble()) + cpu.get_x();
-                test_log << " $" << hi << low << ",X @ " << hex(exp, 4) << " = " << hex(cpu.memory[exp], 2) << std::setw(11);
+                exp = ((((uint16_t) nes.cpu.get_next_high_nibble()) << 8) | nes.cpu.get_next_low_nibble()) + nes.cpu.get_x();
+                test_log << " $" << hi << low << ",X @ " << hex(exp, 4) << " = " << hex(nes.cpu.memory[exp], 2) << std::setw(11);
                 break;
             case AddressingMode::ABSY:
-                exp = ((((uint16_t) cpu.get_next_high_nibble()) << 8) | cpu.get_next_low_nibble()) + cpu.get_y();
-                test_log << " $" << hi << low << ",Y @ " << hex(exp, 4) << " = " << hex(cpu.memory[exp], 2) << std::setw(11);
+                exp = ((((uint16_t) nes.cpu.get_next_high_nibble()) << 8) | nes.cpu.get_next_low_nibble()) + nes.cpu.get_y();
+                test_log << " $" << hi << low << ",Y @ " << hex(exp, 4) << " = " << hex(nes.cpu.memory[exp], 2) << std::setw(11);
                 break;
             case AddressingMode::IND: 
-                exp_low = ((uint16_t) cpu.get_next_high_nibble() << 8) | cpu.get_next_low_nibble();
-                exp_high = ((uint16_t) cpu.get_next_high_nibble() << 8) | ((cpu.get_next_low_nibble() + 1) & 0xFF);
-                exp = ((uint16_t) cpu.memory[exp_high] << 8) | (uint16_t)cpu.memory[exp_low];
+                exp_low = ((uint16_t) nes.cpu.get_next_high_nibble() << 8) | nes.cpu.get_next_low_nibble();
+                exp_high = ((uint16_t) nes.cpu.get_next_high_nibble() << 8) | ((nes.cpu.get_next_low_nibble() + 1) & 0xFF);
+                exp = ((uint16_t) nes.cpu.memory[exp_high] << 8) | (uint16_t)nes.cpu.memory[exp_low];
                 test_log << " ($" << hi << low << ") = " << hex(exp, 4) << std::setw(16);
                 break;
             case AddressingMode::INDX:
-                exp = (cpu.get_next_low_nibble() + cpu.get_x()) & 0xFF;
-                ind_add = ((uint16_t) cpu.memory[(exp + 1) & 0xFF] << 8) | cpu.memory[exp];
-                test_log << " ($" << low << ",X) @ " << hex(exp, 2) << " = " << hex(ind_add, 4) << " = " << hex(cpu.memory[ind_add], 2) << std::setw(6);
+                exp = (nes.cpu.get_next_low_nibble() + nes.cpu.get_x()) & 0xFF;
+                ind_add = ((uint16_t) nes.cpu.memory[(exp + 1) & 0xFF] << 8) | nes.cpu.memory[exp];
+                test_log << " ($" << low << ",X) @ " << hex(exp, 2) << " = " << hex(ind_add, 4) << " = " << hex(nes.cpu.memory[ind_add], 2) << std::setw(6);
                 break;
             case AddressingMode::INDY:
-                exp = (((uint16_t) cpu.memory[(cpu.get_next_low_nibble() + 1) & 0xFF] << 8) | cpu.memory[cpu.get_next_low_nibble()]);
-                ind_add = exp + cpu.get_y();
-                test_log << " ($" << low << "),Y = " << hex(exp, 4) << " @ " << hex(ind_add, 4) << " = " << hex(cpu.memory[ind_add], 2) << std::setw(4);
+                exp = (((uint16_t) nes.cpu.memory[(nes.cpu.get_next_low_nibble() + 1) & 0xFF] << 8) | nes.cpu.memory[nes.cpu.get_next_low_nibble()]);
+                ind_add = exp + nes.cpu.get_y();
+                test_log << " ($" << low << "),Y = " << hex(exp, 4) << " @ " << hex(ind_add, 4) << " = " << hex(nes.cpu.memory[ind_add], 2) << std::setw(4);
                 break;
             case AddressingMode::REL:
-                exp = pcint + (int8_t)cpu.get_next_low_nibble() + 2;
+                exp = pcint + (int8_t)nes.cpu.get_next_low_nibble() + 2;
                 test_log << " $" << hex(exp, 4) << std::setw(25);
                 break;
             case AddressingMode::ABS:
-                exp = ((uint16_t) cpu.get_next_high_nibble() << 8) | cpu.get_next_low_nibble();
-                test_log << " $" << hi << low << " = " << hex(cpu.memory[exp], 2) << std::setw(20);
+                exp = ((uint16_t) nes.cpu.get_next_high_nibble() << 8) | nes.cpu.get_next_low_nibble();
+                test_log << " $" << hi << low << " = " << hex(nes.cpu.memory[exp], 2) << std::setw(20);
                 break;
         }
 
         // Decode and execute instruction
-        int temp = cpu.decode();
+        int temp = nes.cpu.decode();
 
         // Write state of registers
         test_log << "A:" << acc << " X:" << x << " Y:" << y << " P:" << p << " SP:" << sp << " PPU:";
@@ -816,4 +1227,4 @@ std::string hex(uint32_t value, int width)
        << std::setfill('0')
        << value;
     return ss.str();
-}
\ No newline at end of file
+}
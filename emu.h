@@ -1,35 +1,166 @@
-#include "cpu.h"
+#include <vector>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include "nes.h"
+#include "ppu_pipeline.h"
+#include "video_filter.h"
+#include "ntsc_filter.h"
+#include "ppu_viewer.h"
+#include "presenter.h"
+#include "run_ahead.h"
+#include "rewind.h"
+#include "movie.h"
 #include "./SDL2/include/SDL.h"
 
+enum MovieMode {
+    MOVIE_NONE,
+    MOVIE_RECORD,
+    MOVIE_PLAYBACK
+};
+
 class Emulator {
 
     private:
-        CPU cpu;
-        PPU ppu;
-        //PPU ppu;
+        NES nes;
         //APU apu;
+        // nes_test reads nestest.nes through this
         std::fstream romFile;
-        //Size of PRG ROM in 16KB units
-        int prg_rom;
-        //Size CHR ROM in 8KB units; 0 indicates use of CHR RAM
-        int chr_rom;
-        //iNES header flags used for determining which memory mapper to use
-        int flag6;
-        int flag7;
-        bool running;
-
-        // The CPU runs at 1.79 MHz on NTSC systems - clock speed is in nanoseconds
-        double const clock_speed = 1000000000 / 1790000;
-        double render_speed = 1000 / 60;
+        // Emulation runs on its own thread while the one that called run handles SDL, until that thread clears this
+        std::atomic<bool> running;
+        // Only draw every nth frame
+        int frameskip;
+        // Draw frames on a separate thread
+        bool pipelined_rendering;
+        // Upscaling filter to run frames through before they're displayed, and whether a frame is being filtered for the presenter
+        int filter;
+        bool filter_pending;
+        // Decode the PPU's output as an NTSC signal instead of using the RGB palette (takes priority over the filter)
+        bool ntsc_output;
+
+        // Only exist while running, depending on the options above
+        std::unique_ptr<PPURenderThread> render_thread;
+        std::unique_ptr<FilterPipeline> filter_pipeline;
+        std::unique_ptr<NtscFilter> ntsc_filter;
+        std::vector<uint16_t> ntsc_indices;
+
+        // How many times a frame input gets sampled
+        int input_polls;
+        // What's held on the keyboard, sampled by the SDL thread for emulation to pick up - controller 1 in the low byte
+        std::atomic<uint16_t> keyboard_input;
+        std::atomic<bool> rewind_held;
+        // F5 and F9 presses, for emulation to act on at the start of its next frame
+        std::atomic<bool> quick_save_requested;
+        std::atomic<bool> quick_load_requested;
+        // Run as fast as possible instead of at the NES's speed. Toggled with Tab
+        std::atomic<bool> fast_forward;
+        // Frames to run ahead (0 for none), and whether they're run by a second instance on another core. Running ahead on this
+        // thread saves the state into run_ahead_state and loads it back every frame - it's allocated up front like rewind_state
+        int run_ahead;
+        bool run_ahead_instance;
+        std::vector<uint8_t> run_ahead_state;
+        std::unique_ptr<RunAheadWorker> run_ahead_worker;
+        // Run-ahead only shows every nth real frame (more than 1 while fast forwarding), and the others skip running ahead entirely
+        int run_ahead_skip;
+        int run_ahead_skipped;
+        // Seconds of history to keep for rewinding (0 for none), and whether it's happening - it does for as long as backspace is
+        // held (emulation takes that from rewind_held once a frame). Every frame's state goes through rewind_state on its way in
+        // or out of the buffer
+        int rewind_seconds;
+        bool rewinding;
+        std::unique_ptr<RewindBuffer> rewind;
+        std::vector<uint8_t> rewind_state;
+        // Quick save and load (F5 and F9) go to a file next to the ROM. The state is saved into quick_state first, which is
+        // allocated up front like rewind_state
+        std::string state_file;
+        std::vector<uint8_t> quick_state;
+        // A movie being recorded into movie_file, or played back from it (see set_movie_record and set_movie_playback), and how far
+        // into it playback is
+        int movie_mode;
+        std::string movie_file;
+        std::unique_ptr<Movie> movie;
+        int movie_frame;
+
+        // Debug viewer for the PPU's memory, in its own window. Toggled with F1 - none of it exists while it's closed. The SDL
+        // thread opens and closes it, so emulation only touches the viewer (to hand it snapshots) while holding viewer_mutex
+        bool debug_viewer;
+        std::unique_ptr<PPUViewer> viewer;
+        std::atomic<bool> viewer_open;
+        std::mutex viewer_mutex;
+        // The last snapshot of the PPU's memory handed to the viewer (see PPU::take_snapshot)
+        std::shared_ptr<PPUSnapshot> viewer_snapshot;
+        SDL_Window* viewer_window;
+        SDL_Renderer* viewer_renderer;
+        SDL_Texture* viewer_texture;
+
+        // The CPU runs at 1.789773 MHz on NTSC systems and a frame is 29780.5 CPU cycles, which makes for 60.0988 frames a second
+        static constexpr double FRAME_RATE = 1789772.727 / 29780.5;
+
+        // Collected over a few seconds of running and then printed
+        struct PacingStats {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            unsigned long long frames = 0;
+            // Time spent emulating and presenting, as opposed to sleeping
+            std::chrono::steady_clock::duration busy = std::chrono::steady_clock::duration::zero();
+            // How far past (or before) their deadlines frames finished, in milliseconds
+            double total_error = 0;
+            double max_error = 0;
+            int resyncs = 0;
+        };
 
         // Used for rendering
-        const int SCREEN_WIDTH = 640, SCREEN_HEIGHT = 320, LOGICAL_WIDTH = 256, LOGICAL_HEIGHT = 240;
+        const int SCREEN_WIDTH = 640, SCREEN_HEIGHT = 320;
         SDL_Window* window;
-        SDL_Renderer* renderer;
-        SDL_Texture* texture;
+        std::unique_ptr<FramePresenter> presenter;
+        // Refresh rate of the display the window's on, which fast forward tries to keep the frames it draws down to
+        int display_rate;
+        // Window titles only get set from the SDL thread, so emulation leaves them here
+        std::mutex title_mutex;
+        std::string window_title;
+        bool title_changed;
+
+        // Hash of the frame currently on screen
+        uint64_t presented_hash;
+
+        bool open_window();
+        void close_window();
+        void emulation_loop();
+        void run_frame_ahead();
+        void rewind_frame();
+        void quick_save();
+        void quick_load();
+        void step_movie();
+        void handle_events();
+        void poll_input();
+        void set_title(const std::string& title);
+        void report_pacing(const PacingStats& stats, std::chrono::steady_clock::time_point now);
+        void present_frame();
+        void open_viewer();
+        void close_viewer();
+        void update_viewer();
+        void show_viewer();
     public:
         //Emulator(const char * filename);
         Emulator();
         void nes_test();
+        void set_frameskip(int n);
+        void set_pipelined_rendering(bool enabled);
+        void set_filter(int filter);
+        void set_ntsc_output(bool enabled);
+        // Opens the debug viewer as soon as emulation starts
+        void set_debug_viewer(bool open);
+        // Samples input this many times a frame (up to 8) instead of once at the start of each
+        void set_input_polls(int per_frame);
+        // Starts off fast forwarding
+        void set_fast_forward(bool enabled);
+        // Shows frames this many frames (up to 4) ahead of the game to cut input lag, optionally running them on another core
+        void set_run_ahead(int frames, bool second_instance = false);
+        // Keeps this many seconds (up to 10 minutes) of history that can be rewound through by holding backspace
+        void set_rewind(int seconds);
+        // Records the input from when emulation starts until the window's closed into a movie file
+        void set_movie_record(const char * filename);
+        // Plays a movie back from the start, then hands control back to the keyboard once it's over
+        void set_movie_playback(const char * filename);
         void run(const char * filename);
 };
\ No newline at end of file
@@ -0,0 +1,162 @@
+// Runs a ROM with no window, sound or input, as fast as it'll go - for build servers, benchmarks and regression runs. Only needs the
+// core (nes.cpp, cpu.cpp, ppu.cpp, ppu_pipeline.cpp, tile_decode.cpp, mmc3.cpp, movie.cpp), and benchmarks.cpp with the filters and
+// rewind buffer it times (video_filter.cpp, ntsc_filter.cpp, work_pool.cpp, rewind.cpp) - not SDL
+//
+//     headless <rom> [--frames n | --cycles n] [--frameskip n] [--play movie] [--dump-frame file.ppm] [--dump-ram file.bin]
+//     headless <rom> --benchmark name [--frames n]
+//
+// Runs 600 frames if neither --frames nor --cycles is given. --frameskip only draws every nth frame (0 for none at all). --dump-frame
+// writes the last frame drawn as a PPM, --dump-ram writes the 2KB of internal RAM. --play runs a movie (see movie.h) from its start
+// state with its input, for the whole movie unless --frames says otherwise, and checks the state it ends in against the recording -
+// exiting with 1 if it doesn't match. --benchmark runs one of the benchmarks in benchmarks.h on the ROM instead (for --frames
+// frames, passes or iterations if given), exiting with 1 if any of its checks fail. A ROM the core can't run (one that hits an
+// opcode the CPU doesn't know, say) also exits with 1, after saying where it stopped
+#include "nes.h"
+#include "movie.h"
+#include "benchmarks.h"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <string>
+#include <cstdlib>
+#include <stdexcept>
+
+// The CPU's clock on NTSC systems
+static const double CPU_CLOCK = 1789772.727;
+
+static void usage() {
+    std::cout << "Usage: headless <rom> [--frames n | --cycles n] [--frameskip n] [--play movie] [--dump-frame file.ppm]"
+                 " [--dump-ram file.bin]" << std::endl;
+    std::cout << "       headless <rom> --benchmark name [--frames n]" << std::endl;
+}
+
+// The frame buffer is BGRA, PPMs are RGB
+static bool dump_frame(const PPU& ppu, const char * filename) {
+    std::ofstream file(filename, std::ios::out | std::ios::binary);
+    if (!file.is_open()) return false;
+    file << "P6\n256 240\n255\n";
+    for (int i = 0; i < 256 * 240; i++) {
+        const uint8_t* pixel = ppu.frame_buffer + i * 4;
+        char rgb[3] = {(char) pixel[2], (char) pixel[1], (char) pixel[0]};
+        file.write(rgb, 3);
+    }
+    return (bool) file;
+}
+
+static bool dump_ram(const CPU& cpu, const char * filename) {
+    std::ofstream file(filename, std::ios::out | std::ios::binary);
+    if (!file.is_open()) return false;
+    file.write(reinterpret_cast<const char *>(cpu.memory), 0x800);
+    return (bool) file;
+}
+
+int main(int argc, char *argv []) {
+    const char * rom = nullptr;
+    const char * frame_file = nullptr;
+    const char * ram_file = nullptr;
+    const char * movie_file = nullptr;
+    const char * benchmark = nullptr;
+    unsigned long long frames = 600, cycles = 0;
+    int frameskip = 1;
+    bool frames_given = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--frames" && has_value) {
+            frames = std::strtoull(argv[++i], nullptr, 10);
+            frames_given = true;
+            cycles = 0;
+        }
+        else if (arg == "--cycles" && has_value) {
+            cycles = std::strtoull(argv[++i], nullptr, 10);
+            frames = 0;
+        }
+        else if (arg == "--frameskip" && has_value) frameskip = std::atoi(argv[++i]);
+        else if (arg == "--play" && has_value) movie_file = argv[++i];
+        else if (arg == "--benchmark" && has_value) benchmark = argv[++i];
+        else if (arg == "--dump-frame" && has_value) frame_file = argv[++i];
+        else if (arg == "--dump-ram" && has_value) ram_file = argv[++i];
+        else if (!rom && arg[0] != '-') rom = argv[i];
+        else {
+            usage();
+            return 2;
+        }
+    }
+    // Movie input goes a frame at a time
+    if (!rom || (movie_file && cycles)) {
+        usage();
+        return 2;
+    }
+
+    if (benchmark) {
+        try {
+            return run_benchmark(benchmark, rom, frames_given ? (int) frames : 0) ? 0 : 1;
+        }
+        catch (const std::exception& error) {
+            std::cout << "Benchmark stopped: " << error.what() << std::endl;
+            return 1;
+        }
+    }
+
+    // It's a few hundred KB, so it doesn't go on the stack
+    static NES nes;
+    if (!nes.load_rom(rom)) return 1;
+    nes.reset();
+    nes.ppu.set_frameskip(frameskip);
+
+    static Movie movie;
+    if (movie_file) {
+        if (!movie.load(movie_file) || !movie.start_playback(nes)) return 1;
+        if (!frames_given) frames = movie.get_frames();
+    }
+
+    int start_frame = nes.ppu.get_frame_count();
+    unsigned long long start_cycle = nes.cpu.get_cycle_count();
+    auto start = std::chrono::steady_clock::now();
+    try {
+        if (cycles) nes.run_cycles(cycles);
+        else if (movie_file) {
+            // Past the end of the movie, nothing's held
+            for (unsigned long long i = 0; i < frames; i++) {
+                nes.cpu.set_controllers(i < (unsigned long long) movie.get_frames() ? movie.get_input(i) : ControllerSnapshot());
+                nes.run_frame();
+            }
+        }
+        else for (unsigned long long i = 0; i < frames; i++) nes.run_frame();
+    }
+    catch (const std::exception& error) {
+        std::cout << "Stopped after " << nes.ppu.get_frame_count() - start_frame << " frames ("
+                  << nes.cpu.get_cycle_count() - start_cycle << " CPU cycles): " << error.what() << std::endl;
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int frames_run = nes.ppu.get_frame_count() - start_frame;
+    unsigned long long cycles_run = nes.cpu.get_cycle_count() - start_cycle;
+    std::cout << "Ran " << frames_run << " frames (" << cycles_run << " CPU cycles) in " << std::fixed << std::setprecision(3)
+              << seconds << " s" << std::endl;
+    std::cout << std::setprecision(1) << "  " << frames_run / seconds << " frames/s, " << std::setprecision(2)
+              << cycles_run / seconds / 1000000 << " MHz CPU equivalent (" << cycles_run / seconds / CPU_CLOCK << "x real time)"
+              << std::endl;
+    std::cout << "  frame hash " << std::hex << std::setw(16) << std::setfill('0') << nes.ppu.get_frame_hash() << std::dec
+              << std::endl;
+
+    // The final state can only be checked if playback stopped exactly where recording did
+    bool mismatch = false;
+    if (movie_file && frames == (unsigned long long) movie.get_frames()) {
+        mismatch = Movie::hash_state(nes) != movie.get_final_hash();
+        std::cout << "  movie final state " << (mismatch ? "DOESN'T MATCH" : "matches") << " the recording" << std::endl;
+    }
+
+    if (frame_file && !dump_frame(nes.ppu, frame_file)) {
+        std::cout << "Error: couldn't write " << frame_file << std::endl;
+        return 1;
+    }
+    if (ram_file && !dump_ram(nes.cpu, ram_file)) {
+        std::cout << "Error: couldn't write " << ram_file << std::endl;
+        return 1;
+    }
+    return mismatch ? 1 : 0;
+}
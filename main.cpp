@@ -1,8 +1,26 @@
 #include "emu.h"
+#include <string>
+#include <cstdlib>
 
 int main(int argc, char *argv [] ) {
     Emulator emu = Emulator();
+    int run_ahead = 0;
+    bool run_ahead_instance = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--fast-forward") emu.set_fast_forward(true);
+        else if (arg == "--frameskip" && i + 1 < argc) emu.set_frameskip(std::atoi(argv[++i]));
+        else if (arg == "--record" && i + 1 < argc) emu.set_movie_record(argv[++i]);
+        else if (arg == "--play" && i + 1 < argc) emu.set_movie_playback(argv[++i]);
+        else if (arg == "--run-ahead" && i + 1 < argc) run_ahead = std::atoi(argv[++i]);
+        else if (arg == "--run-ahead-instance") run_ahead_instance = true;
+        else if (arg == "--rewind" && i + 1 < argc) emu.set_rewind(std::atoi(argv[++i]));
+    }
+    emu.set_run_ahead(run_ahead, run_ahead_instance);
     //emu.nes_test();
+    //emu.set_ntsc_output(true);
+    //emu.set_debug_viewer(true);
+    //emu.set_input_polls(2);
     emu.run("Donkey Kong (World) (Rev A).nes");
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,44 @@
+#include "mmc3.h"
+
+ScanlineCounter::ScanlineCounter() {
+    latch = 0;
+    counter = 0;
+    reload = false;
+    enabled = false;
+    irq = false;
+}
+
+// When the counter is 0 (or a reload was asked for) it's reloaded from the latch, otherwise it counts down. Either way, if it ends up
+// at 0 the IRQ goes off - so a latch of 0 means an IRQ on every clock
+void ScanlineCounter::clock(int times) {
+    for (int i = 0; i < times; i++) {
+        if (counter == 0 || reload) {
+            counter = latch;
+            reload = false;
+        }
+        else counter--;
+        if (counter == 0 && enabled) irq = true;
+    }
+}
+
+int ScanlineCounter::clocks_until_irq() const {
+    if (!enabled) return 0;
+    if (counter == 0 || reload) return latch + 1;
+    return counter;
+}
+
+bool ScanlineCounter::irq_pending() const { return irq; }
+
+void ScanlineCounter::set_latch(uint8_t value) { latch = value; }
+
+void ScanlineCounter::set_reload() {
+    counter = 0;
+    reload = true;
+}
+
+void ScanlineCounter::disable() {
+    enabled = false;
+    irq = false;
+}
+
+void ScanlineCounter::enable() { enabled = true; }
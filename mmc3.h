@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+
+// MMC3's IRQ counter (mapper 4). The cartridge watches PPU address line A12 and clocks the counter on every rise of it that comes
+// after A12 has been low for a while, which with the usual setup (background and sprites on different pattern tables) happens once
+// per rendered scanline. The PPU works out when those rises happen (see PPU::set_scanline_counter) and clocks this
+class ScanlineCounter {
+
+    private:
+        uint8_t latch;
+        uint8_t counter;
+        bool reload;
+        bool enabled;
+        // The IRQ line - stays asserted until the game acknowledges it by writing to 0xE000
+        bool irq;
+
+    public:
+        ScanlineCounter();
+
+        void clock(int times = 1);
+        // How many clocks from now the IRQ goes off, or 0 if it won't (because it's disabled)
+        int clocks_until_irq() const;
+        bool irq_pending() const;
+
+        // 0xC000
+        void set_latch(uint8_t value);
+        // 0xC001 - the counter is reloaded from the latch on the next clock
+        void set_reload();
+        // 0xE000 - also acknowledges any pending IRQ
+        void disable();
+        // 0xE001
+        void enable();
+
+};
+
+// The rest of the MMC3's state. The CPU handles writes to it (see CPU::mmc3_write)
+struct MMC3 {
+    // 0x8000 - which bank register the next 0x8001 write goes to, plus the PRG and CHR layout bits
+    uint8_t bank_select;
+    // R0 - R5 are CHR banks, R6 and R7 are PRG banks
+    uint8_t banks[8];
+    ScanlineCounter counter;
+};
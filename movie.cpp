@@ -0,0 +1,145 @@
+#include "movie.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+struct MovieHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t rom_hash;
+    uint64_t final_hash;
+    uint32_t frames;
+    uint32_t state_size;
+    // Number of InputRuns after the state
+    uint32_t runs;
+    uint32_t reserved;
+};
+
+// A run of frames with the same input. Most frames have the same input as the one before, so this keeps movies small - a minute of
+// play is typically under a kilobyte on top of the start state
+struct InputRun {
+    uint16_t length;
+    uint8_t buttons[2];
+};
+
+static constexpr char MOVIE_MAGIC[4] = {'S', 'N', 'M', 'V'};
+static constexpr uint32_t MOVIE_VERSION = 1;
+
+Movie::Movie() {
+    rom_hash = 0;
+    final_hash = 0;
+}
+
+void Movie::start_recording(const NES& nes) {
+    rom_hash = nes.get_rom_hash();
+    start_state.resize(nes.get_state_size());
+    nes.save_state(start_state.data(), start_state.size());
+    inputs.clear();
+    // An hour's worth, so recording doesn't have to allocate as it goes
+    inputs.reserve(60 * 60 * 60);
+    final_hash = 0;
+}
+
+void Movie::record_frame(const ControllerSnapshot& input) { inputs.push_back(input); }
+
+void Movie::finish_recording(const NES& nes) { final_hash = hash_state(nes); }
+
+bool Movie::start_playback(NES& nes) const {
+    if (nes.get_rom_hash() != rom_hash) {
+        std::cout << "Error: this movie was recorded with a different ROM." << std::endl;
+        return false;
+    }
+    return nes.load_state(start_state.data(), start_state.size());
+}
+
+const ControllerSnapshot& Movie::get_input(int frame) const { return inputs[frame]; }
+
+int Movie::get_frames() const { return (int) inputs.size(); }
+
+uint64_t Movie::get_final_hash() const { return final_hash; }
+
+bool Movie::save(const char * filename) const {
+
+    std::vector<InputRun> runs;
+    for (const ControllerSnapshot& input : inputs) {
+        bool same = !runs.empty() && runs.back().length < 0xFFFF && runs.back().buttons[0] == input.buttons[0] &&
+                    runs.back().buttons[1] == input.buttons[1];
+        if (same) runs.back().length++;
+        else runs.push_back({1, {input.buttons[0], input.buttons[1]}});
+    }
+
+    MovieHeader header = {};
+    std::copy_n(MOVIE_MAGIC, 4, header.magic);
+    header.version = MOVIE_VERSION;
+    header.rom_hash = rom_hash;
+    header.final_hash = final_hash;
+    header.frames = (uint32_t) inputs.size();
+    header.state_size = (uint32_t) start_state.size();
+    header.runs = (uint32_t) runs.size();
+
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(start_state.data()), start_state.size());
+    file.write(reinterpret_cast<const char *>(runs.data()), runs.size() * sizeof(InputRun));
+    if (!file) {
+        std::cout << "Error: couldn't write the movie to " << filename << std::endl;
+        return false;
+    }
+    return true;
+
+}
+
+bool Movie::load(const char * filename) {
+
+    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        std::cout << "Error: " << filename << " could not be opened." << std::endl;
+        return false;
+    }
+
+    MovieHeader header;
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!file || !std::equal(MOVIE_MAGIC, MOVIE_MAGIC + 4, header.magic)) {
+        std::cout << "Error: " << filename << " isn't a movie." << std::endl;
+        return false;
+    }
+    if (header.version != MOVIE_VERSION) {
+        std::cout << "Error: " << filename << " is from version " << header.version << " (this is version " << MOVIE_VERSION << ")."
+                  << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> state(header.state_size);
+    std::vector<InputRun> runs(header.runs);
+    file.read(reinterpret_cast<char *>(state.data()), state.size());
+    file.read(reinterpret_cast<char *>(runs.data()), runs.size() * sizeof(InputRun));
+    if (!file) {
+        std::cout << "Error: " << filename << " is cut short." << std::endl;
+        return false;
+    }
+
+    std::vector<ControllerSnapshot> frames;
+    frames.reserve(header.frames);
+    for (const InputRun& run : runs) frames.insert(frames.end(), run.length, ControllerSnapshot{{run.buttons[0], run.buttons[1]}});
+    if (frames.size() != header.frames) {
+        std::cout << "Error: " << filename << " has " << frames.size() << " frames of input, but should have " << header.frames << "."
+                  << std::endl;
+        return false;
+    }
+
+    rom_hash = header.rom_hash;
+    final_hash = header.final_hash;
+    start_state.swap(state);
+    inputs.swap(frames);
+    return true;
+
+}
+
+// FNV-1a over the whole state
+uint64_t Movie::hash_state(const NES& nes) {
+    std::vector<uint8_t> state(nes.get_state_size());
+    nes.save_state(state.data(), state.size());
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (uint8_t byte : state) hash = (hash ^ byte) * 0x100000001B3ULL;
+    return hash;
+}
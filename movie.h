@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "nes.h"
+
+// A recording of a game being played: the console's state when recording started (right after power on, unless it was started
+// partway through), then what was held on both controllers every frame after that. Input only ever changes between frames (see
+// ControllerSnapshot), so playing the input back from the same state goes exactly the same way every time - which makes movies
+// usable as benchmarks and regression tests. A movie also keeps a hash of the state it ended on, so playback can check it got there
+// Movie files are the start state (see NES::save_state) followed by the input as runs of identical frames
+class Movie {
+
+    private:
+        uint64_t rom_hash;
+        std::vector<uint8_t> start_state;
+        std::vector<ControllerSnapshot> inputs;
+        // Hash of the state after the last frame (see hash_state), or 0 if recording never finished
+        uint64_t final_hash;
+
+    public:
+        Movie();
+
+        // Recording. Frames are recorded with the input they're about to be run with, and finish_recording is called once the
+        // last of them has been run
+        void start_recording(const NES& nes);
+        void record_frame(const ControllerSnapshot& input);
+        void finish_recording(const NES& nes);
+
+        // Puts nes in the state the movie starts from. nes has to have the movie's ROM loaded - this prints why and returns false if
+        // it doesn't
+        bool start_playback(NES& nes) const;
+        // Input for the nth frame since the start
+        const ControllerSnapshot& get_input(int frame) const;
+        int get_frames() const;
+        uint64_t get_final_hash() const;
+
+        // Prints why and returns false if the file couldn't be written or read
+        bool save(const char * filename) const;
+        bool load(const char * filename);
+
+        // Hash of everything in nes's state (rather than just the frame on screen), for checking playback ended up in the same place
+        static uint64_t hash_state(const NES& nes);
+
+};
@@ -0,0 +1,233 @@
+#include "nes.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <type_traits>
+
+NES::NES() {
+    prg_rom = 0;
+    chr_rom = 0;
+    flag6 = 0;
+    flag7 = 0;
+    mapper = 0;
+    rom_hash = 0;
+    next_ppu_event = 0;
+    cpu.link_ppu(&ppu);
+}
+
+bool NES::load_rom(const char * filename) {
+    // Reset components to known state
+    cpu.manual_reset();
+    ppu.manual_reset();
+
+    std::ifstream rom(filename, std::ios::in | std::ios::binary);
+
+    if (!rom.is_open()) {
+        std::cout << "Error: ROM could not be opened. Please make sure the file path is correct." << std::endl;
+        return false;
+    }
+
+    //Parse file header
+    //Verify file is an ines file (first 4 bytes, the last being an end-of-file character)
+    char header[16];
+    rom.read(header, 16);
+    if (!rom || header[0] != 'N' || header[1] != 'E' || header[2] != 'S' || header[3] != 0x1A) {
+        std::cout << "Error: " << filename << " isn't an iNES file." << std::endl;
+        return false;
+    }
+
+    //Get the number of PRG-ROM and CHR-ROM banks
+    prg_rom = (uint8_t) header[4];
+    chr_rom = (uint8_t) header[5];
+
+    //Parse header flags
+    //This will be done later in more depth
+    flag6 = (uint8_t) header[6];
+    flag7 = (uint8_t) header[7];
+
+    //flags 8-10 are rarely used, bytes 11-15 are unused padding, so just jump to byte 16
+
+    //Load everything into memory based on memory mapper
+    //The mapper we use is determined by an 8 bit number whose lower nibble is the upper nibble of flag6 and whose upper nibble is the
+    //upper nibble of flag7
+    mapper = (flag7 & 0xF0) | (flag6 >> 4);
+    if (!cpu.supports_mapper(mapper)) {
+        std::cout << "Error: " << filename << " uses mapper " << mapper << ", which isn't supported." << std::endl;
+        return false;
+    }
+
+    //Set CPU memory mapper
+    cpu.set_memMap(mapper);
+
+    // Nametable arrangement - bit 3 of flag6 means the cartridge has its own VRAM for four screen mode, otherwise bit 0 picks
+    // vertical or horizontal mirroring. Mappers that switch this at runtime will call set_mirroring themselves
+    if ((flag6 & 8) == 8) ppu.set_mirroring(MIRROR_FOUR_SCREEN);
+    else ppu.set_mirroring((flag6 & 1) ? MIRROR_VERTICAL : MIRROR_HORIZONTAL);
+
+    // Check for trainer; low-key don't know what to do if there is one in terms of writing to memory, so will just skip the trainer
+    // if there is one for now
+    if ((flag6 & 4) == 4) rom.seekg(528);
+
+    // All of PRG ROM is read in. Mappers that bank switch it map their banks in once CHR has been loaded too, otherwise it goes
+    // straight into memory - a single 16KB bank is mirrored into both halves
+    prg_data.resize(0x4000 * prg_rom);
+    rom.read(reinterpret_cast<char *>(prg_data.data()), prg_data.size());
+    if (!rom || prg_rom == 0) {
+        std::cout << "Error: " << filename << " is missing PRG ROM." << std::endl;
+        return false;
+    }
+    if (mapper != 4) {
+        std::copy_n(prg_data.begin(), std::min<size_t>(prg_data.size(), 0x8000), cpu.memory + 0x8000);
+        if (prg_rom == 1) std::copy_n(prg_data.begin(), 0x4000, cpu.memory + 0xC000);
+    }
+
+    // Read CHR-ROM
+    // CHR-ROM is used by the PPU to fill the pattern table, some mappers/games handle pattern tables differently and may
+    // need to account for that
+    // If CHR ROM is 0, CHR RAM is used
+    if (chr_rom != 0) {
+        // All of CHR ROM is kept here and the PPU maps it in through its CHR banks
+        chr_data.resize(0x2000 * chr_rom);
+        rom.read(reinterpret_cast<char *>(chr_data.data()), chr_data.size());
+        ppu.set_chr_rom(chr_data.data(), chr_data.size());
+    }
+    else {
+        chr_data.clear();
+        ppu.set_chr_rom(nullptr, 0);
+    }
+
+    if (mapper == 4) {
+        cpu.set_prg_rom(prg_data.data(), prg_data.size());
+        ppu.set_scanline_counter(cpu.get_scanline_counter());
+    }
+
+    // FNV-1a over both ROMs
+    rom_hash = 0xCBF29CE484222325ULL;
+    for (const std::vector<uint8_t>* data : {&prg_data, &chr_data}) {
+        for (uint8_t byte : *data) rom_hash = (rom_hash ^ byte) * 0x100000001B3ULL;
+    }
+
+    // Lastly, there's PlayChoice ROM which is kinda niche - 8KB of INST ROM plus 32 bytes of PROM if bit 1 of flag 7 is set. Nothing
+    // uses it, and it (like anything else at the end of the file) can be safely ignored
+
+    return true;
+}
+
+void NES::reset() {
+    cpu.interrupt_reset();
+    next_ppu_event = ppu.next_event_cycle();
+}
+
+// Runs one instruction plus whatever interrupts it set off. Returns whether the PPU reached vblank
+bool NES::step() {
+    cpu.decode();
+
+    // A mapper IRQ is due - the PPU has to be caught up for the counter to go off
+    if (cpu.get_cycle_count() >= ppu.get_irq_cycle()) ppu.catch_up(cpu.get_cycle_count());
+
+    // The PPU isn't run alongside the CPU - it catches itself up whenever the CPU touches one of its registers. The only other
+    // time it needs to run is when it's due to raise the vblank NMI
+    bool vblank = false;
+    if (cpu.get_cycle_count() >= next_ppu_event) {
+        ppu.catch_up(cpu.get_cycle_count());
+        next_ppu_event = ppu.next_event_cycle();
+        vblank = true;
+    }
+
+    // Check for NMI being triggered - either by vblank or by a ppuctrl write during vblank
+    if (ppu.nmi_trigger) {
+        ppu.nmi_trigger = false;
+        cpu.interrupt_NMI();
+    }
+    // Mapper IRQs are level triggered - the cartridge keeps asking until the game acknowledges it, which the interrupt disable
+    // flag can hold off
+    if (cpu.irq_pending()) cpu.interrupt_IRQ_generic();
+
+    return vblank;
+}
+
+void NES::run_frame() {
+    while (!step());
+}
+
+void NES::run_cycles(unsigned long long cycles) {
+    unsigned long long end = cpu.get_cycle_count() + cycles;
+    while (cpu.get_cycle_count() < end) step();
+}
+
+// Loading a state is meant to be cheap enough to do several times a frame, which relies on these copying as one block of memory
+static_assert(std::is_trivially_copyable<PPU>::value, "PPU state should be plain data");
+
+void NES::load_state(const NES& other) {
+    if (&other == this) return;
+    cpu = other.cpu;
+    // The copied CPU still points at the other PPU
+    cpu.link_ppu(&ppu);
+    ppu.load_state(other.ppu, cpu.get_scanline_counter());
+    next_ppu_event = other.next_ppu_event;
+    prg_rom = other.prg_rom;
+    chr_rom = other.chr_rom;
+    flag6 = other.flag6;
+    flag7 = other.flag7;
+    mapper = other.mapper;
+    rom_hash = other.rom_hash;
+}
+
+void NES::save_state(StateWriter& out) const {
+    out.write(next_ppu_event);
+    cpu.save_state(out);
+    ppu.save_state(out);
+}
+
+size_t NES::save_state(uint8_t* buffer, size_t size) const {
+    StateHeader header = {};
+    std::copy_n(STATE_MAGIC, 4, header.magic);
+    header.version = STATE_VERSION;
+    header.size = (uint32_t) get_state_size();
+    header.mapper = mapper;
+    header.rom_hash = rom_hash;
+
+    StateWriter out(buffer, size);
+    out.write(header);
+    save_state(out);
+    return out.fits() ? out.size() : 0;
+}
+
+// Everything in the header is checked before any of the state is loaded, so a state that's turned away doesn't change anything
+bool NES::load_state(const uint8_t* buffer, size_t size) {
+    StateReader in(buffer, size);
+    StateHeader header;
+    in.read(header);
+    if (!in.ok() || !std::equal(STATE_MAGIC, STATE_MAGIC + 4, header.magic)) {
+        std::cout << "Error: not a save state." << std::endl;
+        return false;
+    }
+    if (header.version != STATE_VERSION) {
+        std::cout << "Error: save state is from version " << header.version << " (this is version " << STATE_VERSION << ")." << std::endl;
+        return false;
+    }
+    if (header.size != size || size != get_state_size()) {
+        std::cout << "Error: save state is the wrong size." << std::endl;
+        return false;
+    }
+    if (header.mapper != mapper || header.rom_hash != rom_hash) {
+        std::cout << "Error: save state is for a different ROM." << std::endl;
+        return false;
+    }
+
+    in.read(next_ppu_event);
+    cpu.load_state(in);
+    ppu.load_state(in);
+    return in.ok();
+}
+
+size_t NES::get_state_size() const {
+    StateWriter counter;
+    counter.write(StateHeader());
+    save_state(counter);
+    return counter.size();
+}
+
+int NES::get_mapper() const { return mapper; }
+
+uint64_t NES::get_rom_hash() const { return rom_hash; }
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "cpu.h"
+
+// The console on its own - the CPU, PPU and cartridge, without anything to do with windows, input or timing. The SDL frontend
+// (Emulator) drives one of these in real time, and the headless runner runs one as fast as it can
+class NES {
+
+    private:
+        //Size of PRG ROM in 16KB units
+        int prg_rom;
+        //Size CHR ROM in 8KB units; 0 indicates use of CHR RAM
+        int chr_rom;
+        // PRG ROM, for mappers that bank switch it - the CPU copies banks out of it but doesn't own it
+        std::vector<uint8_t> prg_data;
+        // CHR ROM - the PPU reads it through its CHR banks but doesn't own it
+        std::vector<uint8_t> chr_data;
+        //iNES header flags used for determining which memory mapper to use
+        int flag6;
+        int flag7;
+        int mapper;
+        // Hash of PRG and CHR ROM, which save states are checked against
+        uint64_t rom_hash;
+        // CPU cycle the PPU next has to be caught up at (the start of vblank)
+        unsigned long long next_ppu_event;
+
+        bool step();
+        void save_state(StateWriter& out) const;
+
+    public:
+        CPU cpu;
+        PPU ppu;
+
+        NES();
+        // The CPU and PPU point at each other (and the PPU at the cartridge), so a copy would be wired up to the original
+        NES(const NES&) = delete;
+        NES& operator=(const NES&) = delete;
+
+        // Loads an iNES file and maps it in. Prints why and returns false if it couldn't
+        bool load_rom(const char * filename);
+        // Runs the reset interrupt - call once the ROM is loaded and the PPU's outputs are set up
+        void reset();
+        // Runs the CPU up to the start of the next vblank, which is one frame's worth (29780.5 cycles on average)
+        void run_frame();
+        // Runs at least this many CPU cycles (it stops at the end of an instruction)
+        void run_cycles(unsigned long long cycles);
+        // Takes on other's CPU and PPU state, so either NES can be used as a quick in-memory save state for the other. The ROM isn't
+        // copied - this uses other's, so other has to stay around. Where the PPU's output goes is left alone (see PPU::load_state)
+        void load_state(const NES& other);
+        // Writes the console's state into buffer - CPU and PPU registers, RAM, VRAM, OAM, palettes, the PPU's latches and shift
+        // registers and the mapper's registers, after a StateHeader (see state.h). Returns the size of the state, or 0 if it didn't
+        // fit. Nothing is allocated, so this is fine to do every frame (rewind does)
+        size_t save_state(uint8_t* buffer, size_t size) const;
+        // Loads a state written by save_state. Prints why and returns false without changing anything if it's not a state, it's from
+        // another version or it's for a different ROM
+        bool load_state(const uint8_t* buffer, size_t size);
+        // Size of a state from save_state. It's the same for every state
+        size_t get_state_size() const;
+
+        int get_mapper() const;
+        uint64_t get_rom_hash() const;
+
+};
@@ -0,0 +1,125 @@
+#include "ntsc_filter.h"
+#include <cmath>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Signal level of one sample of a pixel, from the nes wiki's NTSC video page. phase is the sample's position in the 12 sample
+// subcarrier cycle. Scaled so black is 0 and white is 1
+static float ntsc_signal(int index, int phase) {
+
+    // Voltage levels, relative to sync
+    const float black = 0.518f, white = 1.962f, attenuation = 0.746f;
+    const float levels[8] = {0.350f, 0.518f, 0.962f, 1.550f,  // Signal low
+                             1.094f, 1.506f, 1.962f, 1.962f}; // Signal high
+
+    int color = index & 0x0F;
+    int level = (index >> 4) & 3;
+    int emphasis = index >> 6;
+    // Colors 14 and 15 are always level 1 (they're black)
+    if (color > 13) level = 1;
+
+    // The square wave for the color alternates between these two
+    float low = levels[level];
+    float high = levels[4 + level];
+    // Color 0 is only ever high and colors 13 - 15 are only ever low, so those are greys
+    if (color == 0) low = high;
+    if (color > 12) high = low;
+
+    auto in_color_phase = [phase](int hue) { return (hue + phase) % 12 < 6; };
+    float signal = in_color_phase(color) ? high : low;
+
+    // Each emphasis bit attenuates the part of the wave lined up with its color (red, green, blue)
+    if (((emphasis & 1) && in_color_phase(0)) || ((emphasis & 2) && in_color_phase(4)) || ((emphasis & 4) && in_color_phase(8))) {
+        signal *= attenuation;
+    }
+
+    return (signal - black) / (white - black);
+
+}
+
+NtscFilter::NtscFilter() {
+
+    const float pi = 3.14159265f;
+
+    for (int index = 0; index < 512; index++) {
+        for (int phase = 0; phase < 3; phase++) {
+            for (int neighbour = 0; neighbour < 3; neighbour++) {
+                // Where this pixel's samples sit relative to the start of the pixel being decoded
+                int offset = (neighbour - 1) * 8;
+
+                for (int out = 0; out < 2; out++) {
+                    // Each output pixel is decoded from the 12 samples centred on it
+                    int window_begin = out * 4 - 4;
+                    float y = 0, i = 0, q = 0;
+                    for (int sample = 0; sample < 8; sample++) {
+                        int position = offset + sample;
+                        if (position < window_begin || position >= window_begin + 12) continue;
+                        int sample_phase = phase * 4 + sample;
+                        float level = ntsc_signal(index, sample_phase) / 12;
+                        y += level;
+                        // The TV decodes relative to the colorburst, which is hue 8, so its reference is 12 - 8 = 4 samples ahead of
+                        // ours. Demodulating a square wave only recovers half its swing, hence the 2
+                        float angle = pi * (sample_phase + 4) / 6;
+                        i += 2 * level * std::cos(angle);
+                        q += 2 * level * std::sin(angle);
+                    }
+
+                    // YIQ to RGB, scaled to 0 - 255 with 4 fractional bits
+                    float rgb[3] = {y + 0.946882f * i + 0.623557f * q,
+                                    y - 0.274788f * i - 0.635691f * q,
+                                    y - 1.108545f * i + 1.709007f * q};
+                    int16_t* dest = &kernels[index][phase][neighbour][out * 4];
+                    dest[0] = (int16_t) std::lround(rgb[2] * 255 * 16);
+                    dest[1] = (int16_t) std::lround(rgb[1] * 255 * 16);
+                    dest[2] = (int16_t) std::lround(rgb[0] * 255 * 16);
+                    // Only the middle one sets alpha so the sum comes out opaque
+                    dest[3] = neighbour == 1 ? 255 * 16 : 0;
+                }
+            }
+        }
+    }
+
+}
+
+void NtscFilter::filter(const uint16_t* indices, uint8_t* dest, int pitch, int frame) const {
+
+    // A scanline is 341 * 8 samples, which is 4 more than a whole number of subcarrier cycles, so each line starts 4 samples
+    // further along than the last. Frames alternate between being a whole number of cycles long and having one dot skipped, which
+    // makes the whole pattern shift every other frame - that's the dot crawl
+    int frame_phase = (frame & 1) * 4;
+
+    for (int row = 0; row < 240; row++) {
+        const uint16_t* line = indices + row * 256;
+        uint8_t* out = dest + row * pitch;
+        // Phase of the first pixel, in units of 4 samples (a pixel is 8 samples, so each pixel is 2 further along)
+        int phase = ((frame_phase + row * 4) % 12) / 4;
+
+        for (int x = 0; x < 256; x++) {
+            // Off the edge of the screen is black
+            int left = x > 0 ? line[x - 1] & 0x1FF : 0x0F;
+            int middle = line[x] & 0x1FF;
+            int right = x < 255 ? line[x + 1] & 0x1FF : 0x0F;
+            int pixel_phase = (phase + 2 * x) % 3;
+
+            const int16_t* a = kernels[left][(pixel_phase + 1) % 3][0];
+            const int16_t* b = kernels[middle][pixel_phase][1];
+            const int16_t* c = kernels[right][(pixel_phase + 2) % 3][2];
+#ifdef __SSE2__
+            __m128i sum = _mm_adds_epi16(_mm_load_si128(reinterpret_cast<const __m128i*>(a)),
+                                         _mm_load_si128(reinterpret_cast<const __m128i*>(b)));
+            sum = _mm_adds_epi16(sum, _mm_load_si128(reinterpret_cast<const __m128i*>(c)));
+            sum = _mm_srai_epi16(sum, 4);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x * 8), _mm_packus_epi16(sum, sum));
+#else
+            for (int channel = 0; channel < 8; channel++) {
+                int value = (a[channel] + b[channel] + c[channel]) >> 4;
+                out[x * 8 + channel] = (uint8_t) std::min(std::max(value, 0), 255);
+            }
+#endif
+        }
+    }
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+
+// NTSC composite video output
+// The real PPU doesn't put out RGB - it puts out a composite signal, 8 samples per pixel of a square wave whose phase (relative to
+// the 12 sample color subcarrier) is the hue and whose levels are the brightness. The TV decodes that back to color, and since it
+// can't perfectly separate brightness from color, you get fringes of artifact color along edges and dot crawl as the subcarrier
+// phase shifts from line to line and frame to frame. This builds the signal from the PPU's 9 bit palette indices and decodes it
+// the same way a TV would
+//
+// Decoding a pixel looks at a 12 sample window, which only ever covers the pixel itself and its two neighbours. Since decoding is
+// linear, each (color, phase, neighbour) combination's share of the final RGB can be worked out ahead of time, so filtering a pixel
+// is just adding up three precomputed vectors
+class NtscFilter {
+
+    private:
+        // For each palette index, each of the 3 phases a pixel can start on (0, 4 or 8 samples into the subcarrier), and whether the
+        // pixel is to the left of, is, or is to the right of the one being decoded: what it adds to the two output pixels, as
+        // BGRA 16 bit fixed point (4 fractional bits)
+        alignas(16) int16_t kernels[512][3][3][8];
+
+    public:
+        // Each input pixel becomes 2 output pixels
+        static const int WIDTH = 512;
+        static const int HEIGHT = 240;
+
+        NtscFilter();
+
+        // indices is a 256x240 frame of palette indices, as captured by PPU::set_index_target. frame is the PPU's frame count, which
+        // decides the phase the frame starts on. dest gets 512x240 BGRA pixels, pitch bytes per row
+        void filter(const uint16_t* indices, uint8_t* dest, int pitch, int frame) const;
+
+};
@@ -1,5 +1,9 @@
 #include "ppu.h"
-#include "./SDL2/include/SDL.h"
+#include "ppu_pipeline.h"
+#include "tile_decode.h"
+#include <cstring>
+#include <algorithm>
+#include <atomic>
 
 // This specifically is the 2C02G palette with emphasized variants from the nes wiki
 constexpr uint8_t sys_palette[512][3] = {
@@ -108,18 +112,139 @@ constexpr uint8_t sys_palette[512][3] = {
 {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00}
 };
 
+// Per dot actions - each dot of each kind of scanline is given one of these codes describing what the PPU does on that dot
+// Each code is a straight line of work so tick() only has to make one jump per dot
+enum DotAction : uint8_t {
+    DOT_IDLE,
+    // Idle dot 0 - the address bus gets the low pattern address (on visible lines only on even frames)
+    DOT_IDLE_FETCH,
+    DOT_IDLE_FETCH_EVEN,
+    DOT_SET_VBLANK,
+    // Visible lines, dots 1 - 256
+    DOT_PIXEL,
+    DOT_PIXEL_LOAD,
+    DOT_PIXEL_INC_X,
+    DOT_PIXEL_INC_XY,
+    // Pre-render line, dots 1 - 256 - same as above without the pixel
+    DOT_RENDER,
+    DOT_RENDER_CLEAR,
+    DOT_RENDER_LOAD,
+    DOT_RENDER_INC_X,
+    DOT_RENDER_INC_XY,
+    // Dots 321 - 336 - fetching for the next scanline
+    DOT_PREFETCH,
+    // Dots 337 - 340 - the two useless nametable fetches
+    DOT_DUMMY_NT_ADDRESS,
+    DOT_DUMMY_NT_BYTE,
+    // Pre-render line, dot 257 and dots 280 - 304
+    DOT_COPY_HORIZONTAL,
+    DOT_COPY_VERTICAL
+};
+
+// Kinds of scanlines
+enum ScanlineClass : uint8_t {
+    SL_VISIBLE,
+    SL_POST_RENDER,
+    SL_VBLANK_START,
+    SL_VBLANK,
+    SL_PRE_RENDER
+};
+
+struct DotTable {
+    uint8_t actions[5][341];
+    uint8_t classes[262];
+};
+
+constexpr DotTable build_dot_table() {
+    DotTable table = {};
+
+    for (int sl = 0; sl < 262; sl++) {
+        if (sl <= 239) table.classes[sl] = SL_VISIBLE;
+        else if (sl == 240) table.classes[sl] = SL_POST_RENDER;
+        else if (sl == 241) table.classes[sl] = SL_VBLANK_START;
+        else if (sl < 261) table.classes[sl] = SL_VBLANK;
+        else table.classes[sl] = SL_PRE_RENDER;
+    }
+
+    for (int d = 0; d < 341; d++) {
+        uint8_t visible = DOT_IDLE;
+        uint8_t pre_render = DOT_IDLE;
+
+        if (d == 0) visible = DOT_IDLE_FETCH_EVEN;
+        else if (d <= 256) {
+            // Every time a nametable byte is fetched with the exception of cycles 1 and 321, the fetched data is loaded into the
+            // shift registers. Coarse x is incremented every 8 dots, and fine y on dot 256
+            if (d == 256) {
+                visible = DOT_PIXEL_INC_XY;
+                pre_render = DOT_RENDER_INC_XY;
+            }
+            else if (d % 8 == 0) {
+                visible = DOT_PIXEL_INC_X;
+                pre_render = DOT_RENDER_INC_X;
+            }
+            else if (d % 8 == 1 && d != 1) {
+                visible = DOT_PIXEL_LOAD;
+                pre_render = DOT_RENDER_LOAD;
+            }
+            else {
+                visible = DOT_PIXEL;
+                pre_render = (d == 1) ? DOT_RENDER_CLEAR : DOT_RENDER;
+            }
+        }
+        else if (d == 257) pre_render = DOT_COPY_HORIZONTAL;
+        else if (d >= 280 && d < 305) pre_render = DOT_COPY_VERTICAL;
+        else if (d >= 321 && d <= 336) visible = pre_render = DOT_PREFETCH;
+        else if (d >= 337) visible = pre_render = (d % 2 == 1) ? DOT_DUMMY_NT_ADDRESS : DOT_DUMMY_NT_BYTE;
+
+        table.actions[SL_VISIBLE][d] = visible;
+        table.actions[SL_POST_RENDER][d] = (d == 0) ? DOT_IDLE_FETCH : DOT_IDLE;
+        table.actions[SL_VBLANK_START][d] = (d == 1) ? DOT_SET_VBLANK : DOT_IDLE;
+        table.actions[SL_VBLANK][d] = DOT_IDLE;
+        table.actions[SL_PRE_RENDER][d] = pre_render;
+    }
+
+    return table;
+}
+
+constexpr DotTable dot_table = build_dot_table();
+constexpr auto& dot_actions = dot_table.actions;
+constexpr auto& scanline_class = dot_table.classes;
+
+constexpr int FRAME_DOTS = 262 * 341;
+// Values of a12_rise_dot that aren't dots
+constexpr int A12_NEVER = 0;
+constexpr int A12_PRECISE = -1;
+// How long A12 has to have been low for the MMC3 to count a rise - it really goes by 3 falling edges of the CPU clock
+constexpr unsigned long long A12_FILTER_DOTS = 10;
+
 // Constructors
 
 // Default constructor
 PPU::PPU() {
-    std::fill_n(memory, 65536, 0);
-    vertical_mirroring = 0;
+    // Where output goes and how often frames are drawn is up to whoever's running the PPU, so a reset leaves these alone
+    dot_observer = false;
+    frameskip = 1;
+    output_pixels = true;
+    write_log = nullptr;
+    frame_target = nullptr;
+    frame_pitch = 256 * 4;
+    index_target = nullptr;
+
+    manual_reset();
+}
+
+// Puts everything back the way it is at power on, ready for a new ROM to be loaded
+void PPU::manual_reset() {
+    std::fill_n(chr_ram, 0x2000, 0);
+    std::fill_n(palette_ram, 32, 0);
+    set_chr_rom(nullptr, 0);
+    std::fill_n(oam, 256, 0);
+    std::fill_n(vram, 0x1000, 0);
+    set_mirroring(MIRROR_HORIZONTAL);
     memory_mapper = 0;
 
     // Initialize frame buffer
-    for (int i = 0; i < 256; i++) {
-        std::fill_n(frame_buffer, 256 * 240 * 4, 0);
-    }
+    std::fill_n(frame_buffer, 256 * 240 * 4, 0);
 
     // Set MMIO registers
     ppuctrl = 0;
@@ -138,11 +263,30 @@ PPU::PPU() {
     w = 0;
     x = 0;
     current_nametable_byte = 0;
+    current_pattern_low_byte = 0;
+    current_pattern_high_byte = 0;
+    current_attribute_byte = 0;
+    pixel_sr = 0;
+    low_attribute_latch = 0;
+    high_attribute_latch = 0;
+    read_buffer = 0;
 
     // Set state variables
     scanline = 261;
     dot = 0;
     frame = 0;
+    sync_cycle = 0;
+    nmi_trigger = false;
+    output_pixels = frameskip != 0;
+    snapshot_stale = true;
+    scanline_counter = nullptr;
+    a12_rise_dot = 0;
+    a12_high = false;
+    a12_low_since = 0;
+    sprite_a12 = 0;
+    irq_cycle = ~0ULL;
+    frame_hash = hash_frame(frame_buffer);
+    frames_drawn = 0;
 
     // Set bus
     address_bus = 0;
@@ -153,34 +297,107 @@ void PPU::set_memory_mapper(int mapper) { memory_mapper = mapper; }
 
 int PPU::get_mapper() const { return memory_mapper; }
 
-void PPU::set_mirroring(int vert) { vertical_mirroring = vert; }
+// Points the 4 nametable slots at the right banks for the given arrangement
+void PPU::set_mirroring(int mode) {
+
+    mirroring = mode;
+    switch (mode) {
+        case MIRROR_HORIZONTAL:
+            set_nametable_bank(0, 0);
+            set_nametable_bank(1, 0);
+            set_nametable_bank(2, 1);
+            set_nametable_bank(3, 1);
+            break;
+        case MIRROR_VERTICAL:
+            set_nametable_bank(0, 0);
+            set_nametable_bank(1, 1);
+            set_nametable_bank(2, 0);
+            set_nametable_bank(3, 1);
+            break;
+        case MIRROR_SINGLE_LOW:
+        case MIRROR_SINGLE_HIGH:
+            for (int i = 0; i < 4; i++) set_nametable_bank(i, mode == MIRROR_SINGLE_HIGH ? 1 : 0);
+            break;
+        case MIRROR_FOUR_SCREEN:
+            for (int i = 0; i < 4; i++) set_nametable_bank(i, i);
+            break;
+    }
+
+}
+
+int PPU::get_mirroring() const { return mirroring; }
+
+void PPU::set_nametable_bank(int slot, int bank) {
+
+    if (write_log) write_log->push(sync_cycle, LOG_NAMETABLE_BANK | (slot & 3), bank);
+    nametables[slot & 3] = (bank & 3) * 0x400;
+    snapshot_stale = true;
+
+}
+
+void PPU::set_chr_rom(const uint8_t* rom, size_t size) {
+
+    chr_rom = rom;
+    chr_rom_size = rom ? size : 0;
+    for (int i = 0; i < 8; i++) set_chr_bank(i, i);
+
+}
 
-int PPU::get_mirroring() const { return vertical_mirroring; }
+// Bank numbers wrap around the size of CHR, like they would on a cartridge with fewer address lines than the mapper has bits
+void PPU::set_chr_bank(int slot, int bank) {
+
+    if (write_log) write_log->push(sync_cycle, LOG_CHR_BANK | (slot & 7), bank);
+
+    uint32_t banks = chr_rom ? chr_rom_size / 0x400 : 8;
+    chr_banks[slot & 7] = banks ? (bank % banks) * 0x400 : 0;
+    snapshot_stale = true;
+
+}
 
 // Modifies t - sets the nametable select bits (bits 10-11) with the 2 least significant bits
 // One special effect is if the vblank nmi flag is flipped from 0 to 1 while ppustatus' vblank flag is set, an NMI will be immediately
 // triggered
 void PPU::set_ppuctrl(uint16_t value) { 
     
+    if (write_log) write_log->push(sync_cycle, 0x2000, value);
+
     uint8_t old_nmi = ppuctrl & 0x80;
     uint8_t new_nmi = value & 0x80;
-    if (old_nmi == 0 && new_nmi != old_nmi) nmi_trigger = true;
+    if (old_nmi == 0 && new_nmi != old_nmi && (ppustatus & 0x80)) nmi_trigger = true;
+    uint8_t old_ctrl = ppuctrl;
     ppuctrl = value;
     t = (t & 0x73FF) | ((value & 3) << 10);
+    snapshot_stale = true;
+    if (scanline_counter) update_a12(old_ctrl, ppumask);
 
 }
 
 uint8_t PPU::get_ppuctrl() const { return ppuctrl; }
 
-void PPU::set_ppumask(uint8_t value) { ppumask = value; }
+void PPU::set_ppumask(uint8_t value) {
+
+    if (write_log) write_log->push(sync_cycle, 0x2001, value);
+    uint8_t old_mask = ppumask;
+    ppumask = value;
+    snapshot_stale = true;
+    if (scanline_counter) update_a12(ppuctrl, old_mask);
+
+}
 
 uint8_t PPU::get_ppumask() const { return ppumask; }
 
-void PPU::set_ppustatus(uint8_t value) { ppustatus = value; }
+void PPU::set_ppustatus(uint8_t value) {
+
+    if (write_log) write_log->push(sync_cycle, 0x2002, value);
+    ppustatus = value;
+
+}
 
 // This sets w to 0 and clears the VBlank flag
 uint8_t PPU::get_ppustatus() {
 
+    if (write_log) write_log->push(sync_cycle, LOG_READ_PPUSTATUS, 0);
+
     w = false;
     uint8_t current_status = ppustatus;
     ppustatus &= ~0x80;
@@ -188,18 +405,36 @@ uint8_t PPU::get_ppustatus() {
 
 }
 
-void PPU::set_oamaddr(uint8_t value) { oamaddr = value; }
+void PPU::set_oamaddr(uint8_t value) {
+
+    if (write_log) write_log->push(sync_cycle, 0x2003, value);
+    oamaddr = value;
+
+}
 
 uint8_t PPU::get_oamaddr() const { return oamaddr; }
 
-void PPU::set_oamdata(uint8_t value) { oamdata = value; }
+// Writes go to OAM at oamaddr, which is then incremented
+void PPU::set_oamdata(uint8_t value) {
+
+    if (write_log) write_log->push(sync_cycle, 0x2004, value);
 
-uint8_t PPU::get_oamdata() const { return oamdata; }
+    oamdata = value;
+    oam[oamaddr] = value;
+    oamaddr++;
+    snapshot_stale = true;
+
+}
+
+// Reads do not increment oamaddr
+uint8_t PPU::get_oamdata() const { return oam[oamaddr]; }
 
 // Toggles w
 // Modifies t and x
 void PPU::set_ppuscroll(uint16_t value) { 
 
+    if (write_log) write_log->push(sync_cycle, 0x2005, value);
+
     // First write
     if (!w) {
 
@@ -229,6 +464,8 @@ uint16_t PPU::get_ppuscroll() const { return ppuscroll; }
 // Modifies t. On the second write, t is copied to v - this copying occurs about a dot after the actual write
 void PPU::set_ppuaddr(uint16_t value) {
 
+    if (write_log) write_log->push(sync_cycle, 0x2006, value);
+
     // First write
     if (!w) {
         
@@ -257,6 +494,8 @@ uint16_t PPU::get_ppuaddr() const { return ppuaddr; }
 // This causes v to increment depending on the value of ppuctrl and has some other funky effects that I will mess with later
 void PPU::set_ppudata(uint8_t value) {
 
+    if (write_log) write_log->push(sync_cycle, 0x2007, value);
+
     write(v, value);
     // This is a quirk of messing with this register during rendering
     // If this happens on a dot where an increment to v is supposed to happen anyway, we don't increment twice, but given how niche
@@ -277,6 +516,8 @@ void PPU::set_ppudata(uint8_t value) {
 // If we read from palette memory we don't have to deal with the read buffer
 uint8_t PPU::get_ppudata() { 
     
+    if (write_log) write_log->push(sync_cycle, LOG_READ_PPUDATA, 0);
+
     if (is_render_enabled() && (scanline == 261 || scanline < 239)) {
         increment_coarse_x();
         increment_fine_y();
@@ -299,22 +540,147 @@ void PPU::set_oamdma(uint8_t value) { oamdma = value; }
 
 uint8_t PPU::get_oamdma() const { return oamdma; }
 
+// Copies a full 256 byte page into OAM. On hardware this is 256 separate reads and writes to 0x2004, but since the CPU is halted
+// the whole time nothing can observe the intermediate state, so we do it in one go. The copy starts at oamaddr and wraps around,
+// and oamaddr ends up where it started
+void PPU::oam_dma(const uint8_t* page) {
+
+    if (write_log) {
+        for (int i = 0; i < 256; i++) write_log->push(sync_cycle, LOG_OAM_DMA | i, page[i]);
+    }
+    std::memcpy(oam + oamaddr, page, 256 - oamaddr);
+    if (oamaddr != 0) std::memcpy(oam, page + (256 - oamaddr), oamaddr);
+    snapshot_stale = true;
+
+}
+
 // Execution related functions
 
 // Runs the PPU for one dot/PPU cycle - a PPU cycle is a third of a CPU cycle
+// Everything the PPU does on a given dot depends only on the kind of scanline it's on and the dot itself, so rather than working
+// it out with a pile of branches every dot, it's worked out once at compile time (see the tables at the top of the file) and we just
+// do whatever the table says
 void PPU::tick() {
+
+    // None of the rendering pipeline (shifting, loading, incrementing v) runs while rendering is disabled
+    bool render = is_render_enabled();
+
+    switch (dot_actions[scanline_class[scanline]][dot]) {
+        case DOT_IDLE:
+            break;
+        case DOT_IDLE_FETCH:
+            if (render) fetch_patterntable_low_address();
+            break;
+        case DOT_IDLE_FETCH_EVEN:
+            if (render && frame % 2 == 0) fetch_patterntable_low_address();
+            break;
+        case DOT_SET_VBLANK:
+            ppustatus |= 0x80;
+            if (ppuctrl & 0x80) nmi_trigger = true;
+            finish_frame();
+            break;
+        case DOT_PIXEL:
+            update_pixel();
+            if (!render) break;
+            shift_srs();
+            fetch();
+            break;
+        case DOT_PIXEL_LOAD:
+            update_pixel();
+            if (!render) break;
+            shift_srs();
+            load_shift_registers();
+            fetch();
+            break;
+        case DOT_PIXEL_INC_X:
+            update_pixel();
+            if (!render) break;
+            shift_srs();
+            fetch();
+            increment_coarse_x();
+            break;
+        case DOT_PIXEL_INC_XY:
+            update_pixel();
+            if (!render) break;
+            shift_srs();
+            fetch();
+            increment_coarse_x();
+            increment_fine_y();
+            break;
+        case DOT_RENDER_CLEAR:
+            // Clear VBlank flag, Sprite 0, and Sprite overflow flags in ppustatus
+            ppustatus = 0;
+            if (!render) break;
+            shift_srs();
+            fetch();
+            break;
+        case DOT_RENDER:
+            if (!render) break;
+            shift_srs();
+            fetch();
+            break;
+        case DOT_RENDER_LOAD:
+            if (!render) break;
+            shift_srs();
+            load_shift_registers();
+            fetch();
+            break;
+        case DOT_RENDER_INC_X:
+            if (!render) break;
+            shift_srs();
+            fetch();
+            increment_coarse_x();
+            break;
+        case DOT_RENDER_INC_XY:
+            if (!render) break;
+            shift_srs();
+            fetch();
+            increment_coarse_x();
+            increment_fine_y();
+            break;
+        case DOT_PREFETCH:
+            fetch();
+            break;
+        case DOT_DUMMY_NT_ADDRESS:
+            if (render) fetch_nametable_address();
+            break;
+        case DOT_DUMMY_NT_BYTE:
+            if (render) current_nametable_byte = read(address_bus);
+            break;
+        case DOT_COPY_HORIZONTAL:
+            if (render) v = (v & 0x7BE0) | (t & 0x41F);
+            break;
+        case DOT_COPY_VERTICAL:
+            if (render) v = (v & 0x41F) | (t & 0x7BE0);
+            break;
+    }
+
+    dot++;
+    // Reached the end of a scanline
+    if (dot == 341) {
+        dot = 0;
+        scanline++;
+
+        // Reached the end of the final scanline
+        if (scanline == 262) next_frame();
+    }
+
+}
+
+// The original branch-per-dot version of tick. This does the exact same thing as tick() and is only kept around so the two can
+// be benchmarked against each other (see ppu_benchmark in benchmarks.cpp)
+void PPU::tick_branching() {
     // Need to consider where in the rendering process we are - e.g. what scanline we are on/where in the scanline we are at
     // Defer updating the window until a full pass of the screen has been made
     // We will keep pixel information in a buffer
 
-    // Disarm nmi trigger
-    nmi_trigger = false;
-
     // These are the visible scanlines - the ppu actually modifies visible pixels in this section
     if (scanline <= 239) {
         // Idle cycle - the address bus is loaded with the address to the low background tile byte
         // If the frame is even and rendering is enabled, we skip this cycle
-        if (dot == 0 && is_render_enabled() && frame % 2 == 0) fetch_patterntable_low_address();
+        if (dot == 0) {
+            if (is_render_enabled() && frame % 2 == 0) fetch_patterntable_low_address();
+        }
 
         // Regular execution - a pixel is selected from the shift registers and it is updated in the pixel buffer
         // At the same time, the PPU is continually fetching data for the next set of 8 pixels
@@ -322,23 +688,25 @@ void PPU::tick() {
             // "Draw" a pixel
             update_pixel();
 
-            // Shift the shift registers - Note that this occurs regardless of if rendering is enabled or not
-            shift_srs();
+            // Shift the shift registers - none of the rendering pipeline (shifting, loading, incrementing v) runs while rendering
+            // is disabled
+            bool render = is_render_enabled();
+            if (render) shift_srs();
 
             int dot_mod = dot % 8;
             // Check if we need to load shift registers
             // Every time a nametable byte is fetched with the exception of cycles 1 and 321, the fetched data is loaded into
             // the appropriate shift register
-            if (dot != 1 && dot_mod == 1) load_shift_registers();
+            if (render && dot != 1 && dot_mod == 1) load_shift_registers();
 
             // Fetching
             fetch();
 
             // Check if we need to increment coarse x - this is done every 8 cycles 
-            if (dot_mod == 0) increment_coarse_x();
+            if (render && dot_mod == 0) increment_coarse_x();
 
             // Check if we need to increment fine y - this is done only on cycle 256
-            if (dot == 256) increment_fine_y();
+            if (render && dot == 256) increment_fine_y();
         }
         // TODO
         else if (dot < 321) {
@@ -358,7 +726,8 @@ void PPU::tick() {
     else if (scanline == 241) {
         if (dot == 1) {
             ppustatus |= 0x80;
-            nmi_trigger = true;
+            if (ppuctrl & 0x80) nmi_trigger = true;
+            finish_frame();
         }
     }
     // VBlank - the PPU essentially does nothing until it reaches scanline 261
@@ -373,23 +742,25 @@ void PPU::tick() {
             // Clear VBlank flag, Sprite 0, and Sprite overflow flags in ppustatus
             if (dot == 1) ppustatus = 0;
 
-            // Shift the shift registers - Note that this occurs regardless of if rendering is enabled or not
-            shift_srs();
+            // Shift the shift registers - none of the rendering pipeline (shifting, loading, incrementing v) runs while rendering
+            // is disabled
+            bool render = is_render_enabled();
+            if (render) shift_srs();
 
             int dot_mod = dot % 8;
             // Check if we need to load shift registers
             // Every time a nametable byte is fetched with the exception of cycles 1 and 321, the fetched data is loaded into
             // the appropriate shift register
-            if (dot != 1 && dot_mod == 1) load_shift_registers();
+            if (render && dot != 1 && dot_mod == 1) load_shift_registers();
 
             // Fetching
             fetch();
 
             // Check if we need to increment coarse x - this is done every 8 cycles 
-            if (dot_mod == 0) increment_coarse_x();
+            if (render && dot_mod == 0) increment_coarse_x();
 
             // Check if we need to increment fine y - this is done only on cycle 256
-            if (dot == 256) increment_fine_y();
+            if (render && dot == 256) increment_fine_y();
         }
         // TODO
         else if (dot < 321) {
@@ -421,12 +792,518 @@ void PPU::tick() {
     }
 
     // Reached the end of the final scanline
-    if (scanline == 262) {
-        scanline = 0;
-        frame++;
+    if (scanline == 262) next_frame();
+}
+
+// There are exactly 3 PPU dots per CPU cycle on NTSC, so catching up is just running 3 dots for every CPU cycle we're behind
+// Stretches where the PPU does nothing (see idle_dots) are jumped over instead of ticked through
+void PPU::catch_up(unsigned long long cpu_cycle) {
+
+    if (cpu_cycle <= sync_cycle) return;
+
+    unsigned long long dots = (cpu_cycle - sync_cycle) * 3;
+
+    // Nothing can change where A12 rises until we're caught up, so when it's predictable, all the rises in between can be counted
+    // up front. Otherwise every fetch has to be looked at
+    bool watch = false;
+    if (scanline_counter) {
+        unsigned long long position = dot_position();
+        if (a12_rise_dot > 0) scanline_counter->clock(a12_rises_before(position + dots) - a12_rises_before(position));
+        watch = a12_rise_dot == A12_PRECISE;
+    }
+
+    while (dots > 0) {
+        int idle = dot_observer ? 0 : idle_dots();
+        if (idle > 0) {
+            int skip = dots < (unsigned long long) idle ? (int) dots : idle;
+            skip_dots(skip);
+            dots -= skip;
+        }
+        else {
+            if (watch) watch_a12();
+            tick();
+            dots--;
+        }
+    }
+    sync_cycle = cpu_cycle;
+
+    // A frame that went precise because of a change mid-frame can go back to counting once it's out of the rendered lines
+    if (scanline_counter) {
+        if (a12_rise_dot == A12_PRECISE && scanline >= 240 && scanline < 261) update_a12(ppuctrl, ppumask);
+        else predict_irq();
     }
+
+}
+
+// Returns how many dots, starting with the current one, would do nothing at all if ticked
+// With rendering enabled, that's the rest of the post-render line and vblank, apart from the dot that sets the vblank flag
+// With rendering disabled, the only dots that do anything are the ones that set and clear the vblank flag. We also stop at the end
+// of the frame so that the frame counter gets bumped
+int PPU::idle_dots() const {
+
+    int current = scanline * 341 + dot;
+    constexpr int vblank_set = 241 * 341 + 1;
+    constexpr int vblank_clear = 261 * 341 + 1;
+    constexpr int frame_end = 262 * 341;
+
+    if (current == vblank_set || current == vblank_clear) return 0;
+
+    if (is_render_enabled()) {
+        if (current > 240 * 341 && current < vblank_set) return vblank_set - current;
+        if (current > vblank_set && current < vblank_clear) return vblank_clear - current;
+        return 0;
+    }
+
+    if (current < vblank_set) return vblank_set - current;
+    if (current < vblank_clear) return vblank_clear - current;
+    return frame_end - current;
+
+}
+
+// Moves the PPU forward without doing anything - only ever used for dots idle_dots says are safe to skip
+void PPU::skip_dots(int dots) {
+
+    int current = scanline * 341 + dot + dots;
+
+    // With rendering off, visible dots still put out the backdrop color. Every skipped dot gets the same one, since nothing can
+    // change it in the middle of a skip
+    if (output_pixels) {
+        uint8_t color = backdrop();
+        for (int position = scanline * 341 + dot; position < current && position < 240 * 341; position++) {
+            int row_dot = position % 341;
+            if (row_dot >= 1 && row_dot <= 256) draw_pixel(position / 341, row_dot - 1, color);
+        }
+    }
+
+    scanline = current / 341;
+    dot = current % 341;
+
+    if (scanline == 262) next_frame();
+
+}
+
+// Wraps back around to scanline 0 and decides whether the new frame gets drawn
+void PPU::next_frame() {
+
+    scanline = 0;
+    frame++;
+    output_pixels = frameskip != 0 && frame % frameskip == 0;
+
+}
+
+// The visible part of the frame is done once vblank starts, so this is where a drawn frame gets its hash
+void PPU::finish_frame() {
+
+    if (!output_pixels) return;
+    frame_hash = hash_frame(get_frame(), frame_pitch);
+    frames_drawn++;
+
+}
+
+// Only every nth frame has its pixels written to the frame buffer. Skipped frames still do everything else (vblank, fetches, v
+// increments, etc.) so the CPU can't tell the difference. 0 means never draw anything (used when another thread does the drawing)
+void PPU::set_frameskip(int n) {
+
+    frameskip = n < 0 ? 1 : n;
+    output_pixels = frameskip != 0 && frame % frameskip == 0;
+
+}
+
+void PPU::set_write_log(PPUWriteLog* log) { write_log = log; }
+
+int PPU::get_frameskip() const { return frameskip; }
+
+bool PPU::is_drawing_frame() const { return output_pixels; }
+
+uint64_t PPU::get_frame_hash() const { return frame_hash; }
+
+unsigned long long PPU::get_frames_drawn() const { return frames_drawn; }
+
+void PPU::set_frame_target(uint8_t* pixels, int pitch) {
+
+    frame_target = pixels;
+    frame_pitch = pixels ? pitch : 256 * 4;
+
+}
+
+const uint8_t* PPU::get_frame() const { return frame_target ? frame_target : frame_buffer; }
+
+int PPU::get_frame_pitch() const { return frame_pitch; }
+
+void PPU::set_index_target(uint16_t* indices) { index_target = indices; }
+
+int PPU::get_frame_count() const { return frame; }
+
+std::shared_ptr<const PPUSnapshot> PPU::take_snapshot(std::shared_ptr<PPUSnapshot>& last) {
+
+    if (last && !snapshot_stale) return last;
+    if (!last || last.use_count() > 1) last = std::make_shared<PPUSnapshot>();
+
+    const uint8_t* chr = chr_rom ? chr_rom : chr_ram;
+    for (int slot = 0; slot < 8; slot++) std::memcpy(last->pattern_tables + slot * 0x400, chr + chr_banks[slot], 0x400);
+    for (int slot = 0; slot < 4; slot++) std::memcpy(last->nametables + slot * 0x400, vram + nametables[slot], 0x400);
+    for (int i = 0; i < 32; i++) last->palette[i] = read(0x3F00 | i);
+    std::memcpy(last->oam, oam, 256);
+    last->ppuctrl = ppuctrl;
+    last->ppumask = ppumask;
+    last->frame = frame;
+    // Shared by every PPU, so a snapshot can't be mistaken for one from a PPU whose state this one was loaded from
+    static std::atomic<unsigned> generations(0);
+    last->generation = ++generations;
+    snapshot_stale = false;
+    return last;
+
+}
+
+void system_color(int index, uint8_t* pixel) {
+
+    pixel[0] = sys_palette[index & 0x1FF][2];
+    pixel[1] = sys_palette[index & 0x1FF][1];
+    pixel[2] = sys_palette[index & 0x1FF][0];
+    pixel[3] = 0xFF;
+
+}
+
+// FNV-1a style, but 8 bytes at a time with 4 independent lanes so the multiplies can overlap. The fold after each multiply pushes
+// the high bits back down, which plain FNV on 64 bit words never does
+uint64_t hash_frame(const uint8_t* frame, int pitch) {
+
+    constexpr uint64_t prime = 0x100000001B3ULL;
+    uint64_t lanes[4] = {0xCBF29CE484222325ULL, 0x84222325CBF29CE4ULL, 0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL};
+
+    // Anything past the 256 pixels of a row (texture padding) isn't part of the frame
+    for (int row = 0; row < 240; row++) {
+        const uint8_t* pixels = frame + row * pitch;
+        for (int i = 0; i < 256 * 4; i += 32) {
+            for (int lane = 0; lane < 4; lane++) {
+                uint64_t word;
+                std::memcpy(&word, pixels + i + lane * 8, 8);
+                lanes[lane] = (lanes[lane] ^ word) * prime;
+                lanes[lane] ^= lanes[lane] >> 32;
+            }
+        }
+    }
+
+    uint64_t hash = lanes[0];
+    for (int lane = 1; lane < 4; lane++) hash = (hash ^ lanes[lane]) * prime;
+    return hash ^ (hash >> 29);
+
+}
+
+void PPU::set_dot_observer(bool attached) { dot_observer = attached; }
+
+// Left alone, the only thing the PPU does that the CPU finds out about is the vblank NMI at scanline 241, dot 1. Everything else
+// (ppustatus, sprite 0 hit, etc.) is only seen when the CPU reads a register, which syncs the PPU anyway
+unsigned long long PPU::next_event_cycle() const {
+
+    int current = scanline * 341 + dot;
+    int target = 241 * 341 + 1;
+    int dots = target - current;
+    if (dots <= 0) dots += 262 * 341;
+    // The vblank dot itself has to be ticked, not just reached, so round up to land just past it
+    return sync_cycle + (dots + 3) / 3;
+
 }
 
+unsigned long long PPU::get_sync_cycle() const { return sync_cycle; }
+
+// A12 and the scanline counter
+
+// Dots since power on - a frame is always 262 lines of 341 dots here
+unsigned long long PPU::dot_position() const { return (unsigned long long) frame * FRAME_DOTS + scanline * 341 + dot; }
+
+// How many times A12 rises before the given dot, going by a12_rise_dot. It rises on each of the 240 visible lines and on the
+// pre-render line - and with the background on the second table, also at the pre-render line's first background fetch, since A12
+// has been low all through vblank
+long long PPU::a12_rises_before(unsigned long long position) const {
+
+    bool after_vblank = a12_rise_dot == 325;
+    long long rises = (long long) (position / FRAME_DOTS) * (after_vblank ? 242 : 241);
+    int within = position % FRAME_DOTS;
+    if (within > a12_rise_dot) rises += std::min(240, (within - a12_rise_dot - 1) / 341 + 1);
+    if (after_vblank && within > 261 * 341 + 5) rises++;
+    if (within > 261 * 341 + a12_rise_dot) rises++;
+    return rises;
+
+}
+
+// A12 is bit 12 of the address, so it's high whenever a pattern is fetched from the second table. Nametable and attribute fetches
+// (0x2000 - 0x2FFF) always have it low. On a rendered line the background fetches come first, then the sprites for the next line
+// (dots 257 - 320), then the first two background tiles of the next line (321 - 336). Fetches put their address out on odd dots -
+// nametable, attribute, then the low and high pattern bytes. Returns the level A12 goes to on the given dot, or -1 if nothing is
+// fetched then. sprite_slots has the table each of the 8 sprite fetches uses
+static int a12_level(int line, int line_dot, bool background_high, uint8_t sprite_slots) {
+
+    if (line >= 240 && line != 261) return -1;
+    if ((line_dot >= 1 && line_dot <= 256) || (line_dot >= 321 && line_dot <= 336)) {
+        int step = line_dot % 8;
+        if (step == 1 || step == 3) return 0;
+        if (step == 5 || step == 7) return background_high;
+        return -1;
+    }
+    if (line_dot >= 257 && line_dot <= 320) {
+        int step = (line_dot - 257) % 8;
+        if (step == 0 || step == 2) return 0;
+        if (step == 4 || step == 6) return (sprite_slots >> ((line_dot - 257) / 8)) & 1;
+        return -1;
+    }
+    if (line_dot == 337 || line_dot == 339) return 0;
+    return -1;
+
+}
+
+// Works out where A12 rises for the current PPUCTRL/PPUMASK. With the background on table 0 and 8x8 sprites on table 1, A12 rises
+// at the first sprite fetch - the other way around, it rises at the first background fetch of the next line. Anything else depends
+// on which tiles get fetched, as does changing the setup in the middle of a rendered line (A12 can rise right then), so those get
+// A12_PRECISE - for the rest of the frame, in the second case
+void PPU::update_a12(uint8_t old_ctrl, uint8_t old_mask) {
+
+    int previous = a12_rise_dot;
+    bool background_high = ppuctrl & 0x10;
+    bool sprites_high = ppuctrl & 0x08;
+    bool rendering_line = scanline < 240 || scanline == 261;
+
+    if (!is_render_enabled()) a12_rise_dot = A12_NEVER;
+    // 8x16 sprites pick their table with the tile number
+    else if (ppuctrl & 0x20) a12_rise_dot = A12_PRECISE;
+    else if (!background_high && sprites_high) a12_rise_dot = 261;
+    else if (background_high && !sprites_high) a12_rise_dot = 325;
+    else if (!background_high && !sprites_high) a12_rise_dot = A12_NEVER;
+    // Both on the second table - A12 only goes low for the odd nametable fetch in between, which may or may not be long enough
+    else a12_rise_dot = A12_PRECISE;
+
+    if (rendering_line && a12_rise_dot != previous) a12_rise_dot = A12_PRECISE;
+
+    // Going precise, the cartridge's filter needs to know how long A12 has been low. Whatever the old setup was, it wasn't
+    // precise, so it was 8x8 sprites - replaying its fetches over the last line's worth of dots gets us there
+    if (a12_rise_dot == A12_PRECISE && previous != A12_PRECISE) {
+        unsigned long long now = dot_position();
+        a12_high = false;
+        a12_low_since = now > FRAME_DOTS ? now - FRAME_DOTS : 0;
+        bool old_render = old_mask & 0x18;
+        for (unsigned long long position = now > 341 ? now - 341 : 0; old_render && position < now; position++) {
+            int within = position % FRAME_DOTS;
+            int level = a12_level(within / 341, within % 341, old_ctrl & 0x10, (old_ctrl & 0x08) ? 0xFF : 0);
+            if (level == 1) a12_high = true;
+            else if (level == 0 && a12_high) {
+                a12_high = false;
+                a12_low_since = position;
+            }
+        }
+    }
+    predict_irq();
+
+}
+
+// The precise version - called for every rendered dot, just before it's ticked
+void PPU::watch_a12() {
+
+    if (!is_render_enabled()) return;
+    if (dot == 257 && (scanline < 240 || scanline == 261)) evaluate_sprite_a12();
+
+    // 8x8 sprites use whatever table PPUCTRL says when they're fetched, 8x16 ones the table their tile number picked
+    uint8_t sprite_slots = (ppuctrl & 0x20) ? sprite_a12 : ((ppuctrl & 0x08) ? 0xFF : 0);
+    int a12 = a12_level(scanline, dot, ppuctrl & 0x10, sprite_slots);
+    if (a12 < 0) return;
+
+    unsigned long long now = dot_position();
+    if (a12 && !a12_high) {
+        if (now - a12_low_since >= A12_FILTER_DOTS) scanline_counter->clock();
+        a12_high = true;
+    }
+    else if (!a12 && a12_high) {
+        a12_high = false;
+        a12_low_since = now;
+    }
+
+}
+
+// Works out which table each of the 8x16 sprite fetches for the next line comes from. Those are the first 8 sprites in OAM that are
+// on this line (as that's how sprite evaluation picks them), and bit 0 of the tile number is the table - slots without a sprite
+// fetch tile 0xFF
+void PPU::evaluate_sprite_a12() {
+
+    // Nothing is in range on the pre-render line
+    int line = scanline == 261 ? -1 : scanline;
+
+    sprite_a12 = 0;
+    int found = 0;
+    for (int sprite = 0; sprite < 64 && found < 8; sprite++) {
+        int row = line - oam[sprite * 4];
+        if (row < 0 || row >= 16) continue;
+        sprite_a12 |= (oam[sprite * 4 + 1] & 1) << found;
+        found++;
+    }
+    for (; found < 8; found++) sprite_a12 |= 1 << found;
+
+}
+
+void PPU::set_scanline_counter(ScanlineCounter* counter) {
+
+    scanline_counter = counter;
+    // Starting from scratch, so nothing to carry over from an old setup
+    a12_rise_dot = A12_NEVER;
+    if (counter) update_a12(ppuctrl, 0);
+    else irq_cycle = ~0ULL;
+
+}
+
+void PPU::load_state(const PPU& other, ScanlineCounter* counter) {
+
+    if (&other == this) return;
+    PPUWriteLog* log = write_log;
+    uint8_t* target = frame_target;
+    int pitch = frame_pitch;
+    uint16_t* indices = index_target;
+    bool observer = dot_observer;
+    int skip = frameskip;
+
+    *this = other;
+
+    write_log = log;
+    frame_target = target;
+    frame_pitch = pitch;
+    index_target = indices;
+    dot_observer = observer;
+    scanline_counter = other.scanline_counter ? counter : nullptr;
+    // Whatever snapshot was taken last was of the state being replaced
+    snapshot_stale = true;
+    // Whether the frame in progress is drawn goes by our frameskip too
+    set_frameskip(skip);
+
+}
+
+void PPU::save_state(StateWriter& out) const {
+
+    out.write(ppuctrl);
+    out.write(ppumask);
+    out.write(ppustatus);
+    out.write(oamaddr);
+    out.write(oamdata);
+    out.write(ppuscroll);
+    out.write(ppuaddr);
+    out.write(ppudata);
+    out.write(oamdma);
+
+    out.write(v);
+    out.write(t);
+    out.write(x);
+    out.write(w);
+    out.write(address_bus);
+    out.write(current_nametable_byte);
+    out.write(current_pattern_low_byte);
+    out.write(current_pattern_high_byte);
+    out.write(current_attribute_byte);
+    out.write(pixel_sr);
+    out.write(high_attribute_latch);
+    out.write(low_attribute_latch);
+    out.write(read_buffer);
+    out.write(nmi_trigger);
+
+    out.write(scanline);
+    out.write(dot);
+    out.write(frame);
+    out.write(sync_cycle);
+
+    out.write(a12_rise_dot);
+    out.write(a12_high);
+    out.write(a12_low_since);
+    out.write(sprite_a12);
+    out.write(irq_cycle);
+
+    out.write(mirroring);
+    out.write(nametables);
+    out.write(chr_banks);
+    out.write(vram);
+    out.write(chr_ram);
+    out.write(palette_ram);
+    out.write(oam);
+
+}
+
+void PPU::load_state(StateReader& in) {
+
+    in.read(ppuctrl);
+    in.read(ppumask);
+    in.read(ppustatus);
+    in.read(oamaddr);
+    in.read(oamdata);
+    in.read(ppuscroll);
+    in.read(ppuaddr);
+    in.read(ppudata);
+    in.read(oamdma);
+
+    in.read(v);
+    in.read(t);
+    in.read(x);
+    in.read(w);
+    in.read(address_bus);
+    in.read(current_nametable_byte);
+    in.read(current_pattern_low_byte);
+    in.read(current_pattern_high_byte);
+    in.read(current_attribute_byte);
+    in.read(pixel_sr);
+    in.read(high_attribute_latch);
+    in.read(low_attribute_latch);
+    in.read(read_buffer);
+    in.read(nmi_trigger);
+
+    in.read(scanline);
+    in.read(dot);
+    in.read(frame);
+    in.read(sync_cycle);
+
+    in.read(a12_rise_dot);
+    in.read(a12_high);
+    in.read(a12_low_since);
+    in.read(sprite_a12);
+    in.read(irq_cycle);
+
+    in.read(mirroring);
+    in.read(nametables);
+    in.read(chr_banks);
+    in.read(vram);
+    in.read(chr_ram);
+    in.read(palette_ram);
+    in.read(oam);
+
+    snapshot_stale = true;
+    set_frameskip(frameskip);
+
+}
+
+// Normally the IRQ goes off on a known rise, which is at a known dot, which is at a known CPU cycle. In the precise case we can't
+// tell which rise will be the one, so the PPU is kept caught up through every rendered line instead
+void PPU::predict_irq() {
+
+    irq_cycle = ~0ULL;
+    if (!scanline_counter || scanline_counter->irq_pending()) return;
+    int clocks = scanline_counter->clocks_until_irq();
+    if (clocks == 0 || a12_rise_dot == A12_NEVER || !is_render_enabled()) return;
+
+    if (a12_rise_dot == A12_PRECISE) {
+        if (scanline < 240 || scanline == 261) irq_cycle = sync_cycle + 1;
+        else irq_cycle = sync_cycle + (261 * 341 - (scanline * 341 + dot) + 2) / 3;
+        return;
+    }
+
+    // Which rise it'll be, then where that rise is (see a12_rises_before for the order they come in)
+    unsigned long long position = dot_position();
+    long long rise = a12_rises_before(position) + clocks - 1;
+    int per_frame = a12_rise_dot == 325 ? 242 : 241;
+    int index = rise % per_frame;
+    int within;
+    if (index < 240) within = index * 341 + a12_rise_dot;
+    else if (index == 240 && per_frame == 242) within = 261 * 341 + 5;
+    else within = 261 * 341 + a12_rise_dot;
+    unsigned long long target = (unsigned long long) (rise / per_frame) * FRAME_DOTS + within;
+    // The rise happens while that dot is being ticked, so it has to have been run
+    irq_cycle = sync_cycle + (target - position + 3) / 3;
+
+}
+
+unsigned long long PPU::get_irq_cycle() const { return irq_cycle; }
+
 // Tile fetching related functions
 
 // The nametable address is essentially just v ignoring the 3 most significant bits (Y fine) and or'ed with 0x2000
@@ -490,8 +1367,8 @@ void PPU::load_shift_registers() {
     uint8_t bit_selector = ((1 & (v >> 1)) * 2 + (1 & (v >> 5)) * 4);
     low_attribute_latch = (current_attribute_byte >> bit_selector) & 1;
     high_attribute_latch = (current_attribute_byte >> (bit_selector + 1)) & 1;
-    low_pattern_sr = (low_pattern_sr & 0xFF00) | current_pattern_low_byte;
-    high_pattern_sr = (high_pattern_sr & 0xFF00) | current_pattern_high_byte;
+    // The new tile's pattern bits go in the low 8 pixels. Its attribute bits get shifted in one pixel at a time from the latches
+    pixel_sr = (pixel_sr & ~0x33333333ULL) | decode_tile_row(current_pattern_low_byte, current_pattern_high_byte);
 
 }
 
@@ -534,32 +1411,37 @@ void PPU::increment_fine_y() {
 
 // This selects bits from our shift registers and updates the corresponding buffer entry with the new pixel data
 void PPU::update_pixel() {
+    // Nothing gets drawn on skipped frames. Once sprites exist, sprite 0 hit has to be worked out before this point
+    if (!output_pixels) return;
+
     // If rendering is disabled, we set every pixel to be the background color
-    // There is a slight nuance in that if v is in the 0x3F00 region, we output whatever color its pointing to
     if (!is_render_enabled()) {
-        // TODO
-        // Do stuff to set the whole frame to the background color
+        draw_pixel(scanline, dot - 1, backdrop());
         return;
     }
 
-    // x selects a bit from each shift register to create a 4 bit number
-    uint8_t bit = 15 - x;
-    uint8_t low_pixel_bit = (low_pattern_sr >> bit) & 1;
-    uint8_t high_pixel_bit = (high_pattern_sr >> bit) & 1;
-    uint8_t bg_pixel = (high_pixel_bit << 1) | low_pixel_bit;
-
-    uint8_t low_palette_bit = (low_attribute_sr >> bit) & 1;
-    uint8_t high_palette_bit = (high_attribute_sr >> bit) & 1;
-    uint8_t palette = (high_palette_bit << 1) | low_palette_bit;
-    // palette * 4 + pixel identifies a color in the background palette
+    // x selects a pixel from the shift register, which is already a 4 bit number - palette * 4 + pixel identifies a color in the
+    // background palette
+    uint8_t bg_pixel = (pixel_sr >> (4 * (15 - x))) & 0xF;
+    // Pixel value 0 is transparent, which shows the background color no matter which palette the tile uses
+    if ((bg_pixel & 3) == 0) bg_pixel = 0;
 
     // TODO - will just focus on the background for now
     // Cross reference with sprite pixel data to determine which gets drawn
 
     // Once that is done, we are left with a 5 bit number S AA PP where S selects the background or sprite palette, A
     // is the attribute data (palette number selector), and P is the pattern table data (pixel value)
-    uint8_t drawn_pixel = (palette << 2) | bg_pixel;
-    uint16_t color_index = read(drawn_pixel | 0x3F00);
+    draw_pixel(scanline, dot - 1, bg_pixel);
+
+}
+
+// There is a slight nuance in that if v is in the 0x3F00 region, we output whatever color its pointing to instead
+uint8_t PPU::backdrop() const { return (v & 0x3F00) == 0x3F00 ? v & 0x1F : 0; }
+
+// Looks up the color for a palette entry and writes it to the frame at the given row and column
+void PPU::draw_pixel(int row, int column, uint8_t palette_entry) {
+
+    uint16_t color_index = read(palette_entry | 0x3F00);
 
     // This byte is used to lookup a color in the system palette. On actual hardware, there is no RGB signal, but here we just store
     // a table of RGB values that someone else made
@@ -568,95 +1450,72 @@ void PPU::update_pixel() {
     if ((ppumask & 1) == 1) color_index &= 0x30;
     // We shift everything over left one so we get a 9 bit address
     uint16_t color_emphasis = ((uint16_t) ppumask & 0xE0) << 1;
+    if (index_target) index_target[row * 256 + column] = color_index | color_emphasis;
 
     // Finally we update the frame buffer with the new color info
-    int offset = (scanline * 256 + dot) * 4;
+    uint8_t* pixel = (frame_target ? frame_target : frame_buffer) + row * frame_pitch + column * 4;
     // blue
-    frame_buffer[offset] = sys_palette[color_index | color_emphasis][2];
+    pixel[0] = sys_palette[color_index | color_emphasis][2];
     // green
-    frame_buffer[offset + 1] = sys_palette[color_index | color_emphasis][1];
+    pixel[1] = sys_palette[color_index | color_emphasis][1];
     // red
-    frame_buffer[offset + 2] = sys_palette[color_index | color_emphasis][0];
+    pixel[2] = sys_palette[color_index | color_emphasis][0];
     // alpha
-    frame_buffer[offset + 3] = SDL_ALPHA_OPAQUE;
+    pixel[3] = 0xFF;
 
 }
 
 void PPU::shift_srs() {
 
-    low_attribute_sr = (low_attribute_sr << 1) | low_attribute_latch;
-    high_attribute_sr = (high_attribute_sr << 1) | high_attribute_latch;
-    low_pattern_sr = (low_pattern_sr << 1) | 1;
-    high_pattern_sr = (high_pattern_sr << 1) | 1;
+    // Like the real shift registers, the pattern bits shifted in are 1s
+    pixel_sr = (pixel_sr << 4) | (high_attribute_latch << 3) | (low_attribute_latch << 2) | 3;
 
 }
 
 // Used to check which portions of rendering are enabled
-bool PPU::is_render_enabled(){ return is_background_enabled() || is_sprite_enabled(); }
+bool PPU::is_render_enabled() const { return is_background_enabled() || is_sprite_enabled(); }
 
-bool PPU::is_background_enabled() { return ((ppumask >> 1) && 1) == 1; }
+// Bit 3 of ppumask shows the background and bit 4 shows sprites (bits 1 and 2 only cover the leftmost 8 pixels)
+bool PPU::is_background_enabled() const { return ((ppumask >> 3) & 1) == 1; }
 
-bool PPU::is_sprite_enabled() { return ((ppumask >> 2) && 1) == 1; }
+bool PPU::is_sprite_enabled() const { return ((ppumask >> 4) & 1) == 1; }
 
 // Write functions
+// 0x3F20 - 0x3FFF mirror 0x3F00 - 0x3F1F, and the first entry of each sprite palette is the same byte as the background one's
+static inline uint8_t palette_index(uint16_t address) {
+    uint8_t index = address & 0x1F;
+    return (index & 0x13) == 0x10 ? index & 0x0F : index;
+}
+
 void PPU::write(uint16_t address, uint8_t val) {
     address &= 0x3FFF;
-    // Pattern table area - no mirroring
+    snapshot_stale = true;
+    // Pattern table area - goes through the CHR banks. CHR ROM can't be written to
     if (address <= 0x1FFF) {
-        memory[address] = val;
+        if (!chr_rom) chr_ram[chr_banks[address >> 10] | (address & 0x3FF)] = val;
     }
-    // Nametable/attribute tables. Mirroring depends on mapper in use
+    // Nametable/attribute tables. 0x3000 - 0x3EFF mirrors 0x2000 - 0x2EFF, which falls out of only looking at bits 10-11
     else if (address <= 0x3EFF) {
-        (this->*writes[memory_mapper])(address, val);
+        vram[nametables[(address >> 10) & 3] | (address & 0x3FF)] = val;
     }
     // Palette data
-    else if (address <= 0x3FFF) {
-        // This is a design departure from what I've been doing, but I can't be bothered to think how mirroring works in this region
-        if (address >= 0x3F20) {
-            address &= 0x3F1F;
-        }
-
-        // If we alter the background color
-        if (address % 4 == 0) {
-            for (int i = 0; i < 8; i++) {
-                memory[(address + 4 * i) & 0x1F] = val;
-            }
-        }
-        else {
-            memory[address] = val;
-        }
-    }
-}
-
-// Default memory mapper
-void PPU::default_write(uint16_t address, uint8_t &val) {
-    memory[address] = val;
-    // Nametable 1 (0x2000) and nametable 3 (0x2800) are the same table. Likewise nametable 2 and 4 are the same
-    if (vertical_mirroring) {
-        memory[(address + 0x800) % 0x1000];
-    }
-    // Nametable 1 = nametable 2
     else {
-        memory[address ^ 0x400] = val;
+        palette_ram[palette_index(address)] = val;
     }
 }
 
-// Read function
 uint8_t PPU::read(uint16_t address) {
     address &= 0x3FFF;
-    // Pattern table area - no mirroring
-    if (address <= 0x3EFF) {
-        if (address >= 0x3000) {
-            address &= ~0x1000;
-        }
-        return memory[address];
+    // Pattern table area - see write
+    if (address <= 0x1FFF) {
+        return (chr_rom ? chr_rom : chr_ram)[chr_banks[address >> 10] | (address & 0x3FF)];
+    }
+    // Nametables - see write
+    else if (address <= 0x3EFF) {
+        return vram[nametables[(address >> 10) & 3] | (address & 0x3FF)];
     }
     // Palette data
     else {
-        if (address >= 0x3F20) {
-            address &= 0x3F1F;
-        }
-
-        return memory[address];
+        return palette_ram[palette_index(address)];
     }
 }
\ No newline at end of file
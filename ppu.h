@@ -1,6 +1,46 @@
+#pragma once
 #include <cstdint>
 #include <memory>
 #include <unordered_map>
+#include "mmc3.h"
+#include "state.h"
+
+class PPUWriteLog;
+
+// 64 bit hash of a 256x240 BGRA frame (pitch is the size of a row in bytes)
+uint64_t hash_frame(const uint8_t* frame, int pitch = 256 * 4);
+
+// Writes the BGRA color the PPU draws for a 9 bit palette index (emphasis bits and color) to pixel
+void system_color(int index, uint8_t* pixel);
+
+// Everything the debug viewers need to draw the PPU's memory, as it was at one point in time. The pattern tables and nametables are
+// copied as they're currently mapped, so bank switching and mirroring are already taken care of
+struct PPUSnapshot {
+    uint8_t pattern_tables[0x2000];
+    uint8_t nametables[0x1000];
+    uint8_t palette[32];
+    uint8_t oam[256];
+    uint8_t ppuctrl;
+    uint8_t ppumask;
+    // The frame the snapshot was taken on. Nothing changes between frames a lot of the time, in which case this stays at the first
+    // frame those contents were seen on
+    int frame;
+    // Different every time a snapshot's contents are taken (snapshots get reused, so the pointer doesn't tell you anything)
+    unsigned generation;
+};
+
+// Nametable arrangements. The PPU only has 2KB of its own VRAM (CIRAM) for 4 nametables, so the cartridge decides how they map onto it
+enum Mirroring {
+    // 0x2000 = 0x2400 and 0x2800 = 0x2C00
+    MIRROR_HORIZONTAL,
+    // 0x2000 = 0x2800 and 0x2400 = 0x2C00
+    MIRROR_VERTICAL,
+    // All four nametables are the first/second KB of CIRAM
+    MIRROR_SINGLE_LOW,
+    MIRROR_SINGLE_HIGH,
+    // The cartridge supplies another 2KB so every nametable is unique
+    MIRROR_FOUR_SCREEN
+};
 
 // This class represents the PPU (duh, again). The NES used a 2C02
 class PPU {
@@ -44,10 +84,10 @@ class PPU {
         uint8_t current_pattern_low_byte;
         uint8_t current_pattern_high_byte;
         uint8_t current_attribute_byte;
-        uint16_t high_pattern_sr;
-        uint16_t low_pattern_sr;
-        uint16_t high_attribute_sr;
-        uint16_t low_attribute_sr;
+        // Background pixel shift register - 16 pixels, 4 bits each (AAPP: attribute bits then pattern bits), the next pixel out at the
+        // top. This stands in for the two pattern and two attribute shift registers on the real PPU, so a whole tile row can be
+        // loaded at once and a pixel comes out with one shift
+        uint64_t pixel_sr;
         uint8_t high_attribute_latch;
         uint8_t low_attribute_latch;
         uint8_t read_buffer;
@@ -57,16 +97,73 @@ class PPU {
         int dot;
         // Used to track even/odd frames
         int frame;
+        // The CPU cycle the PPU has been run up to. The PPU is only run when something can observe it, so it lags behind the CPU
+        unsigned long long sync_cycle;
+        // Set when something needs to see every single dot, which stops catch_up from skipping idle stretches
+        bool dot_observer;
+        // Only every frameskip'th frame is drawn - output_pixels is whether the current one is
+        int frameskip;
+        bool output_pixels;
+        // When pipelined rendering is on, every state changing register access is written here for the render thread to replay
+        PPUWriteLog* write_log;
+        // Hash of the last frame that was drawn, and how many frames have been drawn so far. Updated when vblank starts
+        uint64_t frame_hash;
+        unsigned long long frames_drawn;
+        // Where drawn pixels go, and the size of one of its rows in bytes. nullptr means our own frame_buffer - the frontend can
+        // point this at something else (like a locked texture) so the frame doesn't have to be copied there afterwards
+        uint8_t* frame_target;
+        int frame_pitch;
+        // If set, the 9 bit palette index (emphasis bits and color) of every drawn pixel is written here as well, 256 per row. This
+        // is what a real PPU puts out, so it's what the NTSC filter works from
+        uint16_t* index_target;
+        // Whether anything a snapshot covers has changed since the last one was taken. Snapshots are only ever taken when a debug
+        // viewer asks for one, so all this costs otherwise is setting the flag on writes. The snapshot itself is kept by whoever
+        // asked for it - everything in here is plain data, so copying a PPU (for save states) is a straight memory copy
+        bool snapshot_stale;
+
+        // Cartridge IRQ counter clocked by rises of address line A12 (MMC3), if there is one
+        ScanlineCounter* scanline_counter;
+        // With the background and 8x8 sprites on different pattern tables, A12 rises once per rendered line at a fixed dot, which
+        // is this. The rises can then be counted and predicted without watching any fetches. A12_NEVER if it doesn't rise at all,
+        // A12_PRECISE if every fetch has to be looked at (8x16 sprites, both on the same table, or the setup changed mid-frame)
+        int a12_rise_dot;
+        // Only used in the A12_PRECISE case: whether A12 is high, the dot it last went low on (the cartridge ignores rises that
+        // come too soon after that), and with 8x16 sprites, the pattern table each of the 8 sprite slots on the next line uses
+        bool a12_high;
+        unsigned long long a12_low_since;
+        uint8_t sprite_a12;
+        // The CPU cycle the counter's IRQ is due on
+        unsigned long long irq_cycle;
 
         // Not sure if this is needed
         int memory_mapper;
         // Used to configure nametable mirroring
-        int vertical_mirroring;
+        int mirroring;
+
+        // Nametable memory - the first 2KB is the PPU's own VRAM (CIRAM), the second 2KB is the extra VRAM four screen cartridges
+        // provide. This is treated as 4 banks of 1KB
+        uint8_t vram[0x1000];
+        // Each of the 4 nametable slots (0x2000, 0x2400, 0x2800, 0x2C00) holds the offset of the vram bank it maps to. These are
+        // offsets rather than pointers so that copying a PPU (e.g. to snapshot it) doesn't leave them pointing into the old one
+        uint16_t nametables[4];
+
+        // Pattern tables. Cartridges with CHR ROM hand us a pointer to it (they own it, and it's never written, so copies of the PPU
+        // can share it) - the rest have 8KB of CHR RAM, which lives here
+        uint8_t chr_ram[0x2000];
+        const uint8_t* chr_rom;
+        uint32_t chr_rom_size;
+        // Each of the 8 1KB pattern table slots holds the offset of the CHR bank it maps to - offsets for the same reason as above
+        uint32_t chr_banks[8];
+
+        // Palette RAM - 0x3F10, 0x3F14, 0x3F18 and 0x3F1C are mirrors of 0x3F00, 0x3F04, 0x3F08 and 0x3F0C, so only 28 of these
+        // are really distinct
+        uint8_t palette_ram[32];
 
         // Memory
         /*
         Like the CPU, the PPU can address 64KB of memory, though it only actually has 16 (addresses past 3FFF are wrapped around)
-        The situation is actually similar for the CPU, however, I was unaware when desigining that class; may need to adjust later
+        None of it is one big array though - each region below is backed by its own storage (chr_ram/chr_rom, vram, palette_ram)
+        sized to what's really there
         Layout:
             Pattern Tables: 0000 - 0x1FFF
                 Pattern tables store the 8x8 pixel tiles which can be drawn
@@ -94,7 +191,8 @@ class PPU {
                 palette. Bits 6 and 7 of each entry are ignorable
                 - Image Palette: 0x3F00 - 0x3F0F
                     The colors usable for the background
-                    0x3F00 is The Background Color (used when a sprite is transparent) and it is mirrored every four bytes
+                    0x3F00 is The Background Color (used wherever a pixel is transparent) - the first entry of every other palette
+                    is never drawn, since it's transparent
                 - Sprite Palette: 0x3F10 - 0x3F1F
                     The colors usable for the sprites
                 - Mirrors of 0x3F00 - 0x3F1F: 0x3F20 - 0x3FFF
@@ -115,39 +213,99 @@ class PPU {
         void increment_fine_y();
 
         void update_pixel();
+        uint8_t backdrop() const;
+        void draw_pixel(int row, int column, uint8_t palette_entry);
 
         void shift_srs();
 
-        // Return true if certain flags are true
-        bool is_render_enabled();
-        bool is_background_enabled();
-        bool is_sprite_enabled();
-
-        // Write functions
-        void default_write(uint16_t address, uint8_t& val);
+        int idle_dots() const;
+        unsigned long long dot_position() const;
+        long long a12_rises_before(unsigned long long position) const;
+        void update_a12(uint8_t old_ctrl, uint8_t old_mask);
+        void watch_a12();
+        void evaluate_sprite_a12();
+        void skip_dots(int dots);
+        void next_frame();
+        void finish_frame();
 
-        // Nametable arrangement is determined by mapper and as such we use a table of function pointers to handle this
-        std::unordered_map<int, void (PPU::*) (uint16_t address, uint8_t& val)> writes = {
-            {0, &PPU::default_write}
-        };
+        // Return true if certain flags are true
+        bool is_render_enabled() const;
+        bool is_background_enabled() const;
+        bool is_sprite_enabled() const;
 
         uint8_t read(uint16_t address);
     public:
-        uint8_t memory[65536];
+        // Object attribute memory - 64 sprites, 4 bytes each. This lives inside the PPU and is separate from the address space above
+        uint8_t oam[256];
         // Pixel information
         uint8_t frame_buffer[256 * 240 * 4];
-        // Used to trigger NMIs
+        // Used to trigger NMIs - stays set until the emulator services it
         bool nmi_trigger;
         PPU();
+        // Puts the PPU back in its power on state. Where it draws to, its write log and its frameskip are kept
+        void manual_reset();
         void tick();
+        void tick_branching();
+        // Runs the PPU forward until it reaches the given CPU cycle. Anything that reads or writes PPU state (the CPU touching the
+        // MMIO registers, a mapper watching the address bus) should call this first
+        void catch_up(unsigned long long cpu_cycle);
+        // The CPU cycle at which the PPU next does something the CPU can notice without touching it (the vblank NMI)
+        unsigned long long next_event_cycle() const;
+        unsigned long long get_sync_cycle() const;
+        // Anything that watches the PPU dot by dot (e.g. a mapper snooping the address bus) should attach itself here
+        void set_dot_observer(bool attached);
+
+        void set_frameskip(int n);
+        void set_write_log(PPUWriteLog* log);
+        int get_frameskip() const;
+        bool is_drawing_frame() const;
+        // Lets the frontend skip presenting frames that are identical to the last one, and gives tests something to compare
+        uint64_t get_frame_hash() const;
+        unsigned long long get_frames_drawn() const;
+        // Draws into pixels (pitch bytes per row) from now on, or back into frame_buffer if pixels is nullptr. The frame isn't
+        // redrawn, so the new target only has a full frame in it once the next drawn frame is finished
+        void set_frame_target(uint8_t* pixels, int pitch);
+        const uint8_t* get_frame() const;
+        int get_frame_pitch() const;
+        void set_index_target(uint16_t* indices);
+        // Number of frames since power on - the NTSC filter needs to know if it's an odd or even one
+        int get_frame_count() const;
+        // Returns the PPU's memory as it is right now. last is the caller's snapshot from the previous call - if none of the memory
+        // has changed since, it's handed back again without copying anything. Otherwise it's overwritten if nobody else is holding on
+        // to it, or replaced with a new one if someone is (copy on write), so a viewer thread can keep reading its snapshot while
+        // emulation carries on
+        std::shared_ptr<const PPUSnapshot> take_snapshot(std::shared_ptr<PPUSnapshot>& last);
+        // Attaches the cartridge's A12 counter (or detaches it, if nullptr). The PPU clocks it as it runs and works out when its IRQ
+        // will go off, so that the emulator can catch the PPU up right then (see get_irq_cycle)
+        void set_scanline_counter(ScanlineCounter* counter);
+        // Takes on all of other's emulation state, for saving and loading states in memory (e.g. for run-ahead). Where this PPU's
+        // output goes (frame/index targets, write log, dot observer) and its frameskip are left alone, and counter stands in for
+        // other's A12 counter (if it has one), since that belongs to the other PPU's CPU
+        void load_state(const PPU& other, ScanlineCounter* counter);
+        // The same emulation state as above, to and from a save state (see state.h). The frame buffer and its hash aren't included,
+        // since they're output and depend on which frames were drawn, and neither is CHR ROM - the saved banks are offsets into whatever ROM this PPU already has
+        void save_state(StateWriter& out) const;
+        void load_state(StateReader& in);
+        // Mappers call this after changing the counter's registers
+        void predict_irq();
+        // The CPU cycle the PPU needs to be caught up to for the counter's IRQ to go off on time. Never, if it isn't going to
+        unsigned long long get_irq_cycle() const;
         void write(uint16_t address, uint8_t val);
 
         // Setters + Getters
         void set_memory_mapper(int mapper);
         int get_mapper() const;
     
-        void set_mirroring(int vert);
+        void set_mirroring(int mode);
         int get_mirroring() const;
+        // Lets mappers that switch nametables themselves point a slot (0 - 3) at any 1KB bank of vram (0 - 1 are CIRAM, 2 - 3 are
+        // cartridge VRAM)
+        void set_nametable_bank(int slot, int bank);
+        // Points the pattern tables at CHR ROM (size bytes) with the first 8KB mapped, or back at CHR RAM if rom is nullptr. The
+        // caller keeps ownership of rom
+        void set_chr_rom(const uint8_t* rom, size_t size);
+        // Lets mappers that switch CHR banks point a slot (0 - 7, 1KB each) at any 1KB bank of CHR
+        void set_chr_bank(int slot, int bank);
 
         void set_ppuctrl(uint16_t value);
         uint8_t get_ppuctrl() const;
@@ -175,4 +333,6 @@ class PPU {
 
         void set_oamdma(uint8_t value);
         uint8_t get_oamdma() const;
+
+        void oam_dma(const uint8_t* page);
 };
\ No newline at end of file
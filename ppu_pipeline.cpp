@@ -0,0 +1,154 @@
+#include "ppu_pipeline.h"
+#include <algorithm>
+
+// Write log
+
+PPUWriteLog::PPUWriteLog() {
+    head = 0;
+    tail = 0;
+}
+
+void PPUWriteLog::push(unsigned long long cycle, uint16_t type, uint8_t value) {
+
+    size_t h = head.load(std::memory_order_relaxed);
+    // Full - wait for the render thread to catch up
+    while (h - tail.load(std::memory_order_acquire) == SIZE) std::this_thread::yield();
+
+    entries[h & (SIZE - 1)] = {cycle, type, value};
+    head.store(h + 1, std::memory_order_release);
+
+}
+
+bool PPUWriteLog::pop(PPULogEntry& entry) {
+
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) return false;
+
+    entry = entries[t & (SIZE - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+
+}
+
+bool PPUWriteLog::empty() const { return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire); }
+
+// Render thread
+
+PPURenderThread::PPURenderThread(const PPU& source) {
+    ppu = std::make_unique<PPU>(source);
+    // The render side is the one that draws, and it never logs anything itself
+    ppu->set_frameskip(1);
+    ppu->set_write_log(nullptr);
+    // The cartridge's counter belongs to the emulation side as well
+    ppu->set_scanline_counter(nullptr);
+    log = std::make_unique<PPUWriteLog>();
+    running = false;
+    frame_ready = false;
+    std::fill_n(&frames[0][0], 2 * 256 * 240 * 4, 0);
+    completed = 0;
+    completed_hash = hash_frame(frames[completed]);
+    ppu->set_frame_target(frames[1 - completed], 256 * 4);
+}
+
+PPURenderThread::~PPURenderThread() { stop(); }
+
+void PPURenderThread::start() {
+    if (running) return;
+    running = true;
+    thread = std::thread(&PPURenderThread::loop, this);
+}
+
+void PPURenderThread::stop() {
+    running = false;
+    if (thread.joinable()) thread.join();
+}
+
+PPUWriteLog* PPURenderThread::get_log() { return log.get(); }
+
+void PPURenderThread::end_frame(unsigned long long cycle) { log->push(cycle, LOG_FRAME_END, 0); }
+
+// Keep replaying until we're told to stop and there's nothing left in the log
+void PPURenderThread::loop() {
+    PPULogEntry entry;
+    while (running || !log->empty()) {
+        if (log->pop(entry)) replay(entry);
+        else std::this_thread::yield();
+    }
+}
+
+// Runs our PPU up to the time of the access, then does the access - since it sees the exact same accesses at the exact same times
+// as the emulation side PPU, it ends up in the exact same state
+void PPURenderThread::replay(const PPULogEntry& entry) {
+
+    ppu->catch_up(entry.cycle);
+
+    switch (entry.type) {
+        case 0x2000:
+            ppu->set_ppuctrl(entry.value);
+            break;
+        case 0x2001:
+            ppu->set_ppumask(entry.value);
+            break;
+        case 0x2002:
+            ppu->set_ppustatus(entry.value);
+            break;
+        case 0x2003:
+            ppu->set_oamaddr(entry.value);
+            break;
+        case 0x2004:
+            ppu->set_oamdata(entry.value);
+            break;
+        case 0x2005:
+            ppu->set_ppuscroll(entry.value);
+            break;
+        case 0x2006:
+            ppu->set_ppuaddr(entry.value);
+            break;
+        case 0x2007:
+            ppu->set_ppudata(entry.value);
+            break;
+        case LOG_READ_PPUSTATUS:
+            ppu->get_ppustatus();
+            break;
+        case LOG_READ_PPUDATA:
+            ppu->get_ppudata();
+            break;
+        case LOG_FRAME_END: {
+            std::lock_guard<std::mutex> lock(frame_mutex);
+            if (ppu->get_frame_hash() == completed_hash) break;
+            completed = 1 - completed;
+            completed_hash = ppu->get_frame_hash();
+            frame_ready = true;
+            ppu->set_frame_target(frames[1 - completed], 256 * 4);
+            break;
+        }
+        default:
+            // OAM DMA bytes land at oamaddr + offset, same as PPU::oam_dma
+            if ((entry.type & 0xFF00) == LOG_OAM_DMA) ppu->oam[(ppu->get_oamaddr() + (entry.type & 0xFF)) & 0xFF] = entry.value;
+            else if ((entry.type & 0xFF00) == LOG_CHR_BANK) ppu->set_chr_bank(entry.type & 0xFF, entry.value);
+            else if ((entry.type & 0xFF00) == LOG_NAMETABLE_BANK) ppu->set_nametable_bank(entry.type & 0xFF, entry.value);
+            break;
+    }
+
+    // NMIs are the emulation side's business
+    ppu->nmi_trigger = false;
+
+}
+
+bool PPURenderThread::has_new_frame() {
+    std::lock_guard<std::mutex> lock(frame_mutex);
+    return frame_ready;
+}
+
+bool PPURenderThread::copy_frame(uint8_t* dest, int pitch) {
+
+    std::lock_guard<std::mutex> lock(frame_mutex);
+    if (!frame_ready) return false;
+
+    for (int row = 0; row < 240; row++) {
+        std::copy_n(frames[completed] + row * 256 * 4, 256 * 4, dest + row * pitch);
+    }
+    frame_ready = false;
+    return true;
+
+}
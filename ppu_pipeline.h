@@ -0,0 +1,90 @@
+#pragma once
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include "ppu.h"
+
+// Pipelined rendering splits the PPU in two. The PPU the CPU talks to only keeps track of what the CPU can see (it never draws any
+// pixels), and every register access that changes PPU state is written to a log along with the CPU cycle it happened on. A second
+// PPU on its own thread replays the log and does all of the actual drawing, a frame behind the emulation
+
+// Log entry types other than the register accesses themselves (which use the register's address, 0x2000 - 0x2007)
+// Reads of 0x2002 and 0x2007 change PPU state (w, the vblank flag, v, the read buffer), so they're logged as well
+constexpr uint16_t LOG_READ_PPUSTATUS = 0x2102;
+constexpr uint16_t LOG_READ_PPUDATA = 0x2107;
+// One byte of an OAM DMA - the low byte of the type is the offset within the page
+constexpr uint16_t LOG_OAM_DMA = 0x4100;
+// Mapper bank switches - the low byte of the type is the slot
+constexpr uint16_t LOG_CHR_BANK = 0x4200;
+constexpr uint16_t LOG_NAMETABLE_BANK = 0x4300;
+// Marks the end of a frame - the render thread publishes its frame buffer when it gets here
+constexpr uint16_t LOG_FRAME_END = 0xFFFF;
+
+struct PPULogEntry {
+    unsigned long long cycle;
+    uint16_t type;
+    uint8_t value;
+};
+
+// Single producer/single consumer ring buffer. The emulation thread is the only writer and the render thread the only reader, so
+// the two indices are all the synchronization needed
+class PPUWriteLog {
+
+    private:
+        static const size_t SIZE = 1 << 16;
+        PPULogEntry entries[SIZE];
+        // Next entry to be written (only changed by the producer) and next entry to be read (only changed by the consumer)
+        std::atomic<size_t> head;
+        std::atomic<size_t> tail;
+
+    public:
+        PPUWriteLog();
+        // Blocks (yielding) if the render thread has fallen a whole buffer behind
+        void push(unsigned long long cycle, uint16_t type, uint8_t value);
+        bool pop(PPULogEntry& entry);
+        bool empty() const;
+
+};
+
+class PPURenderThread {
+
+    private:
+        // The render thread's own copy of the PPU, VRAM and all
+        std::unique_ptr<PPU> ppu;
+        std::unique_ptr<PPUWriteLog> log;
+        std::thread thread;
+        std::atomic<bool> running;
+
+        // The render thread's PPU draws straight into one of these while the other holds the most recent finished frame. They swap
+        // when a frame is finished, so nothing gets copied on this side
+        uint8_t frames[2][256 * 240 * 4];
+        int completed;
+        // Frames identical to the last one handed over aren't handed over again
+        uint64_t completed_hash;
+        bool frame_ready;
+        std::mutex frame_mutex;
+
+        void loop();
+        void replay(const PPULogEntry& entry);
+
+    public:
+        // Starts from a copy of the given PPU's current state
+        PPURenderThread(const PPU& source);
+        ~PPURenderThread();
+
+        void start();
+        // Waits for the log to be drained before stopping
+        void stop();
+
+        PPUWriteLog* get_log();
+        void end_frame(unsigned long long cycle);
+
+        // Whether there's a frame that hasn't been copied out yet
+        bool has_new_frame();
+        // Copies the most recently completed frame into dest (pitch is the size of a row in bytes). Returns false if no new frame
+        // has been completed since the last call
+        bool copy_frame(uint8_t* dest, int pitch);
+
+};
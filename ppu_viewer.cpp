@@ -0,0 +1,160 @@
+#include "ppu_viewer.h"
+#include <cstring>
+#include <algorithm>
+
+static const int PITCH = PPUViewer::WIDTH * 4;
+
+// Fills a size x size block of the image, so things can be drawn bigger than they are
+static void fill_block(uint8_t* image, int x, int y, int size, const uint8_t* color) {
+    for (int row = 0; row < size; row++) {
+        uint8_t* pixel = image + (y + row) * PITCH + x * 4;
+        for (int column = 0; column < size; column++) std::memcpy(pixel + column * 4, color, 4);
+    }
+}
+
+// Draws the 8x8 tile whose 16 bytes start at tile with the given 4 colors (color 0 being whatever's behind it)
+static void draw_tile(uint8_t* image, int x, int y, const uint8_t* tile, const uint8_t colors[4][4], bool flip_h, bool flip_v,
+                      int scale) {
+    for (int row = 0; row < 8; row++) {
+        uint8_t low = tile[flip_v ? 7 - row : row];
+        uint8_t high = tile[(flip_v ? 7 - row : row) + 8];
+        for (int column = 0; column < 8; column++) {
+            int bit = flip_h ? column : 7 - column;
+            int value = (((high >> bit) & 1) << 1) | ((low >> bit) & 1);
+            fill_block(image, x + column * scale, y + row * scale, scale, colors[value]);
+        }
+    }
+}
+
+PPUViewer::PPUViewer() {
+    std::fill_n(&images[0][0], 2 * WIDTH * HEIGHT * 4, 0);
+    finished = 0;
+    fresh = false;
+    decoded_generation = 0;
+    decoded_any = false;
+    quitting = false;
+    worker = std::thread(&PPUViewer::worker_loop, this);
+}
+
+PPUViewer::~PPUViewer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quitting = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+// The PPU decides whether it can write over its last snapshot by checking use_count, which is only a relaxed load - it doesn't
+// order the worker's reads of the snapshot before the writes. So the snapshot gets taken under the same lock the worker lets go
+// of it under
+void PPUViewer::publish(PPU& ppu, std::shared_ptr<PPUSnapshot>& last) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = ppu.take_snapshot(last);
+    }
+    wake.notify_all();
+}
+
+bool PPUViewer::has_new_image() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return fresh;
+}
+
+bool PPUViewer::get_image(uint8_t* dest, int pitch) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!fresh) return false;
+    for (int row = 0; row < HEIGHT; row++) std::memcpy(dest + row * pitch, images[finished] + row * PITCH, PITCH);
+    fresh = false;
+    return true;
+}
+
+// Decodes whatever's pending into the image that isn't the finished one, then swaps them
+void PPUViewer::worker_loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this] { return quitting || pending; });
+        if (quitting) return;
+
+        std::shared_ptr<const PPUSnapshot> snapshot = std::move(pending);
+        pending.reset();
+        // The PPU hands back the same snapshot, untouched, when nothing has changed
+        if (decoded_any && snapshot->generation == decoded_generation) continue;
+        int target = 1 - finished;
+        lock.unlock();
+
+        decode(*snapshot, images[target]);
+        decoded_generation = snapshot->generation;
+        decoded_any = true;
+
+        lock.lock();
+        // Let go of it before waiting again, so the PPU can write the next one into it (see publish)
+        snapshot.reset();
+        finished = target;
+        fresh = true;
+    }
+}
+
+void PPUViewer::decode(const PPUSnapshot& snapshot, uint8_t* image) {
+    // All 32 palette entries as colors, emphasis included
+    uint8_t colors[8][4][4];
+    int emphasis = (snapshot.ppumask & 0xE0) << 1;
+    for (int i = 0; i < 32; i++) system_color((snapshot.palette[i] & 0x3F) | emphasis, colors[i / 4][i % 4]);
+    // Pixel value 0 is transparent in every palette, so it's always the backdrop
+    for (int palette = 0; palette < 8; palette++) std::memcpy(colors[palette][0], colors[0][0], 4);
+
+    std::fill_n(image, WIDTH * HEIGHT * 4, 0);
+
+    // Nametables
+    const uint8_t* background = snapshot.pattern_tables + ((snapshot.ppuctrl & 0x10) ? 0x1000 : 0);
+    for (int table = 0; table < 4; table++) {
+        const uint8_t* nametable = snapshot.nametables + table * 0x400;
+        int x = (table & 1) * 256, y = (table >> 1) * 240;
+        for (int tile_y = 0; tile_y < 30; tile_y++) {
+            for (int tile_x = 0; tile_x < 32; tile_x++) {
+                // Each attribute byte covers 4x4 tiles, 2 bits for each 2x2 quarter of it
+                uint8_t attribute = nametable[0x3C0 + (tile_y / 4) * 8 + tile_x / 4];
+                int palette = (attribute >> (((tile_y & 2) << 1) | (tile_x & 2))) & 3;
+                draw_tile(image, x + tile_x * 8, y + tile_y * 8, background + nametable[tile_y * 32 + tile_x] * 16, colors[palette],
+                          false, false, 1);
+            }
+        }
+    }
+
+    // Pattern tables
+    for (int table = 0; table < 2; table++) {
+        for (int tile = 0; tile < 256; tile++) {
+            draw_tile(image, 512 + table * 128 + (tile % 16) * 8, (tile / 16) * 8, snapshot.pattern_tables + table * 0x1000 + tile * 16,
+                      colors[0], false, false, 1);
+        }
+    }
+
+    // Sprites - 8x16 sprites pick their pattern table with bit 0 of the tile number and are made of that tile and the next one
+    bool tall = snapshot.ppuctrl & 0x20;
+    for (int sprite = 0; sprite < 64; sprite++) {
+        const uint8_t* entry = snapshot.oam + sprite * 4;
+        uint8_t tile = entry[1];
+        uint8_t attributes = entry[2];
+        bool flip_h = attributes & 0x40, flip_v = attributes & 0x80;
+        int x = 512 + (sprite % 8) * 32, y = 128 + (sprite / 8) * 32;
+        const uint8_t (*sprite_colors)[4] = colors[4 + (attributes & 3)];
+
+        if (!tall) {
+            const uint8_t* table = snapshot.pattern_tables + ((snapshot.ppuctrl & 0x08) ? 0x1000 : 0);
+            draw_tile(image, x + 8, y + 8, table + tile * 16, sprite_colors, flip_h, flip_v, 2);
+        }
+        else {
+            const uint8_t* top = snapshot.pattern_tables + (tile & 1) * 0x1000 + (tile & 0xFE) * 16;
+            // Flipping vertically swaps the two halves as well as flipping each of them
+            draw_tile(image, x + 8, y, top + (flip_v ? 16 : 0), sprite_colors, flip_h, flip_v, 2);
+            draw_tile(image, x + 8, y + 16, top + (flip_v ? 0 : 16), sprite_colors, flip_h, flip_v, 2);
+        }
+    }
+
+    // Palettes
+    for (int i = 0; i < 32; i++) {
+        uint8_t color[4];
+        system_color((snapshot.palette[i] & 0x3F) | emphasis, color);
+        fill_block(image, 512 + (i % 16) * 16, 384 + (i / 16) * 16, 16, color);
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "ppu.h"
+
+// Debug viewers for the PPU's memory - the 4 nametables, both pattern tables, all 64 sprites and the palettes, drawn side by side
+// into one image:
+//     0 - 511 across, 0 - 479 down: the nametables, laid out the way the PPU addresses them
+//     512 - 767 across, 0 - 127 down: pattern tables 0 and 1, in the first background palette
+//     512 - 767 across, 128 - 383 down: the sprites in OAM order, 8 to a row, at twice their size
+//     512 - 767 across, 384 - 415 down: the background palettes, then the sprite palettes
+// Emulation only hands over a PPUSnapshot once a frame. All the decoding happens on the viewer's own thread, so the only cost to
+// emulation is taking the snapshot, and nothing at all when no viewer is open
+class PPUViewer {
+
+    private:
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable wake;
+        // The newest snapshot that hasn't been decoded yet. If emulation gets ahead, older ones are just dropped
+        std::shared_ptr<const PPUSnapshot> pending;
+        // Generation of the last snapshot decoded, so an unchanged one isn't decoded again. Only the number is kept - holding on to
+        // the snapshot itself would stop the PPU from reusing it
+        unsigned decoded_generation;
+        bool decoded_any;
+        bool quitting;
+
+        // The worker decodes into one image while the other is the finished one. fresh is whether the finished one is newer than
+        // what get_image last handed out
+        uint8_t images[2][768 * 480 * 4];
+        int finished;
+        bool fresh;
+
+        void worker_loop();
+        void decode(const PPUSnapshot& snapshot, uint8_t* image);
+
+    public:
+        static const int WIDTH = 768;
+        static const int HEIGHT = 480;
+
+        PPUViewer();
+        ~PPUViewer();
+
+        // Takes a snapshot of ppu's memory (see PPU::take_snapshot - last is the caller's snapshot from the previous call) and
+        // queues it to be decoded. Never waits on the decoding
+        void publish(PPU& ppu, std::shared_ptr<PPUSnapshot>& last);
+        // Whether an image has been decoded since get_image last handed one out
+        bool has_new_image();
+        // Copies the latest decoded image into dest (pitch bytes per row), if there's been a new one since the last call
+        bool get_image(uint8_t* dest, int pitch);
+
+};
@@ -0,0 +1,67 @@
+#include "presenter.h"
+#include <cstdio>
+
+FramePresenter::FramePresenter(SDL_Window* window, int width, int height) : width(width), height(height) {
+    for (std::vector<uint8_t>& buffer : buffers) buffer.assign(width * height * 4, 0);
+    back = 0;
+    middle = 1;
+    front = 2;
+    frames_presented = 0;
+    frames_dropped = 0;
+    texture = nullptr;
+
+    // Emulation has its own thread, so presenting can wait for vsync without holding it up
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    if (renderer == NULL) {
+        printf("Error creating SDL renderer: %s\n", SDL_GetError());
+        return;
+    }
+    SDL_RenderSetLogicalSize(renderer, 256, 240);
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+
+    // Display a blank screen
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
+    SDL_RenderPresent(renderer);
+}
+
+FramePresenter::~FramePresenter() {
+    if (texture) SDL_DestroyTexture(texture);
+    if (renderer) SDL_DestroyRenderer(renderer);
+}
+
+uint8_t* FramePresenter::get_back_buffer() { return buffers[back].data(); }
+
+int FramePresenter::get_pitch() const { return width * 4; }
+
+void FramePresenter::publish() {
+    int previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+    back = previous & 3;
+    if (previous & FRESH) frames_dropped++;
+    // Not holding the mutex here means wait_for_frame can miss this, but only until its wait times out
+    wake.notify_one();
+}
+
+bool FramePresenter::wait_for_frame(std::chrono::milliseconds timeout) {
+    if (middle.load(std::memory_order_acquire) & FRESH) return true;
+    std::unique_lock<std::mutex> lock(mutex);
+    return wake.wait_for(lock, timeout, [this] { return (middle.load(std::memory_order_acquire) & FRESH) != 0; });
+}
+
+bool FramePresenter::present() {
+    if (!renderer || !(middle.load(std::memory_order_acquire) & FRESH)) return false;
+    front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+
+    SDL_UpdateTexture(texture, nullptr, buffers[front].data(), width * 4);
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    SDL_RenderPresent(renderer);
+    frames_presented++;
+    return true;
+}
+
+bool FramePresenter::has_failed() const { return renderer == nullptr; }
+
+unsigned long long FramePresenter::get_frames_presented() const { return frames_presented; }
+
+unsigned long long FramePresenter::get_frames_dropped() const { return frames_dropped; }
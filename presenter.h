@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include "./SDL2/include/SDL.h"
+
+// Puts finished frames on screen without emulation ever waiting on it. SDL can only be driven from the thread it was set up on,
+// so the uploading and presenting (which can block on the driver or on vsync) happens there, and emulation runs on a thread of
+// its own (see Emulator::run). Frames go through a triple buffer: emulation draws into the back buffer and publish() swaps it
+// with the middle one, and present() swaps the middle one with its front buffer whenever there's something new there. Both swaps
+// are a single atomic exchange, so neither side ever waits on the other - if emulation publishes twice before the next present(),
+// the older frame is just dropped
+class FramePresenter {
+
+    private:
+        static const int FRESH = 4;
+
+        SDL_Renderer* renderer;
+        SDL_Texture* texture;
+        int width, height;
+        std::vector<uint8_t> buffers[3];
+        // Owned by emulation
+        int back;
+        // Index of the middle buffer, plus FRESH if it holds a frame the presenter hasn't picked up yet
+        std::atomic<int> middle;
+        // Owned by the presenting thread
+        int front;
+
+        // Only for wait_for_frame to sleep on - publish() never takes the mutex
+        std::mutex mutex;
+        std::condition_variable wake;
+
+        std::atomic<unsigned long long> frames_presented;
+        std::atomic<unsigned long long> frames_dropped;
+
+    public:
+        // Frames are width x height BGRA. The renderer and texture are made on the calling thread, which has to be the one SDL
+        // was set up on - so do present() and wait_for_frame() from there. window has to outlive this
+        FramePresenter(SDL_Window* window, int width, int height);
+        ~FramePresenter();
+
+        // Where the next frame should be drawn (get_pitch() bytes per row). Changes after every publish()
+        uint8_t* get_back_buffer();
+        int get_pitch() const;
+        // Hands the back buffer over to be shown. Never waits, and can be called from any one thread at a time
+        void publish();
+
+        // Waits until there's a frame that hasn't been shown yet, or until timeout's up. Returns whether there is one
+        bool wait_for_frame(std::chrono::milliseconds timeout);
+        // Shows the newest published frame, if it hasn't been shown already. Blocks on vsync when it does. Returns whether it did
+        bool present();
+
+        // Whether the renderer couldn't be set up - nothing ever gets shown if so
+        bool has_failed() const;
+        unsigned long long get_frames_presented() const;
+        // Frames that were published but replaced by a newer one before they were presented
+        unsigned long long get_frames_dropped() const;
+
+};
@@ -0,0 +1,199 @@
+#include "rewind.h"
+#include <algorithm>
+#include <cstring>
+
+// A run of unchanged bytes has to be at least this long to be worth ending a run of changed ones for
+static constexpr size_t MIN_UNCHANGED = 4;
+
+static uint64_t load64(const uint8_t* bytes) {
+    uint64_t value;
+    std::memcpy(&value, bytes, 8);
+    return value;
+}
+
+// Lengths are stored 7 bits at a time, low bits first, with the top bit set on every byte but the last
+static uint8_t* write_length(uint8_t* out, size_t length) {
+    while (length >= 0x80) {
+        *out++ = (uint8_t) (length | 0x80);
+        length >>= 7;
+    }
+    *out++ = (uint8_t) length;
+    return out;
+}
+
+static const uint8_t* read_length(const uint8_t* in, size_t& length) {
+    length = 0;
+    int shift = 0;
+    while (*in & 0x80) {
+        length |= (size_t) (*in++ & 0x7F) << shift;
+        shift += 7;
+    }
+    length |= (size_t) *in++ << shift;
+    return in;
+}
+
+RewindBuffer::RewindBuffer(size_t state_size, int frames, size_t arena_size, int keyframe_interval) : state_size(state_size) {
+    this->keyframe_interval = std::max(1, keyframe_interval);
+    // A state that doesn't compress at all comes out a little bigger than it went in
+    scratch.resize(state_size + 32);
+    arena.resize(std::max(arena_size, scratch.size()));
+    entries.resize(std::max(1, frames));
+    key_state.resize(state_size);
+    zeroes.assign(state_size, 0);
+    clear();
+}
+
+void RewindBuffer::push(const uint8_t* state) {
+
+    int last = newest();
+    bool keyframe = count == 0 || key_entry < 0 || entries[last].key != key_entry || entries[last].since_key + 1 >= keyframe_interval;
+    size_t size = compress(state, keyframe ? zeroes.data() : key_state.data(), scratch.data());
+
+    // Make room by forgetting the oldest frames. If that would mean forgetting the keyframe this one is diffed against, everything
+    // older is already gone, so this starts over as a keyframe instead
+    size_t offset = 0;
+    while (count == (int) entries.size() || !find_room(size, offset)) {
+        if (!keyframe && entries[oldest].key == key_entry) {
+            clear();
+            keyframe = true;
+            size = compress(state, zeroes.data(), scratch.data());
+        }
+        else drop_oldest_group();
+    }
+
+    int index = (oldest + count) % entries.size();
+    entries[index] = {offset, size, keyframe ? index : key_entry, keyframe ? 0 : entries[last].since_key + 1};
+    std::memcpy(arena.data() + offset, scratch.data(), size);
+    count++;
+    bytes_used += size;
+    if (keyframe) {
+        std::memcpy(key_state.data(), state, state_size);
+        key_entry = index;
+    }
+
+}
+
+bool RewindBuffer::pop(uint8_t* state) {
+
+    if (count == 0) return false;
+    int index = newest();
+    const Entry& entry = entries[index];
+
+    if (entry.since_key == 0) {
+        decompress(arena.data() + entry.offset, zeroes.data(), state);
+        // This keyframe's going, so whatever's pushed next has to start a new one
+        key_entry = -1;
+    }
+    else {
+        // Once we've gone back past a keyframe, the deltas before it need the keyframe before that
+        if (key_entry != entry.key) {
+            const Entry& key = entries[entry.key];
+            decompress(arena.data() + key.offset, zeroes.data(), key_state.data());
+            key_entry = entry.key;
+        }
+        decompress(arena.data() + entry.offset, key_state.data(), state);
+    }
+
+    bytes_used -= entry.size;
+    count--;
+    return true;
+
+}
+
+void RewindBuffer::clear() {
+    oldest = 0;
+    count = 0;
+    bytes_used = 0;
+    key_entry = -1;
+}
+
+int RewindBuffer::get_frames() const { return count; }
+
+size_t RewindBuffer::get_bytes_used() const { return bytes_used; }
+
+double RewindBuffer::get_bytes_per_minute() const { return count ? bytes_used * 60.0 * 60.0 / count : 0; }
+
+int RewindBuffer::newest() const { return (oldest + count + entries.size() - 1) % entries.size(); }
+
+// A compressed state is pairs of run lengths - bytes that are the same as in base, then bytes that aren't - with the changed bytes
+// (XORed with base) after each pair. Unchanged runs are checked 8 bytes at a time, since that's most of any delta
+size_t RewindBuffer::compress(const uint8_t* state, const uint8_t* base, uint8_t* out) const {
+
+    uint8_t* start = out;
+    size_t position = 0;
+    while (position < state_size) {
+        size_t same = position;
+        while (same + 8 <= state_size && load64(state + same) == load64(base + same)) same += 8;
+        while (same < state_size && state[same] == base[same]) same++;
+
+        // Changed bytes go on until there's a long enough run of unchanged ones (short ones are just included)
+        size_t changed = same;
+        size_t unchanged = 0;
+        while (changed + unchanged < state_size && unchanged < MIN_UNCHANGED) {
+            if (state[changed + unchanged] == base[changed + unchanged]) unchanged++;
+            else {
+                changed += unchanged + 1;
+                unchanged = 0;
+            }
+        }
+
+        out = write_length(out, same - position);
+        out = write_length(out, changed - same);
+        for (size_t i = same; i < changed; i++) *out++ = state[i] ^ base[i];
+        position = changed;
+    }
+    return out - start;
+
+}
+
+void RewindBuffer::decompress(const uint8_t* in, const uint8_t* base, uint8_t* state) const {
+
+    size_t position = 0;
+    while (position < state_size) {
+        size_t same, changed;
+        in = read_length(in, same);
+        in = read_length(in, changed);
+        std::memcpy(state + position, base + position, same);
+        position += same;
+        for (size_t i = 0; i < changed; i++) state[position + i] = base[position + i] ^ in[i];
+        in += changed;
+        position += changed;
+    }
+
+}
+
+// The arena is used as a ring, so what's in it is either in one piece or wrapped around the end. A state is never split across the
+// end - if it doesn't fit after the newest one, it goes at the start
+bool RewindBuffer::find_room(size_t size, size_t& offset) const {
+
+    if (count == 0) {
+        offset = 0;
+        return size <= arena.size();
+    }
+
+    size_t tail = entries[oldest].offset;
+    const Entry& last = entries[newest()];
+    size_t head = last.offset + last.size;
+    if (head > tail) {
+        if (arena.size() - head >= size) offset = head;
+        else if (tail >= size) offset = 0;
+        else return false;
+        return true;
+    }
+    if (tail - head >= size) {
+        offset = head;
+        return true;
+    }
+    return false;
+
+}
+
+// Deltas are no use without their keyframe, so they're all dropped along with it
+void RewindBuffer::drop_oldest_group() {
+    do {
+        if (oldest == key_entry) key_entry = -1;
+        bytes_used -= entries[oldest].size;
+        oldest = (oldest + 1) % entries.size();
+        count--;
+    } while (count > 0 && entries[oldest].since_key != 0);
+}
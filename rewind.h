@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// The last few seconds of save states, for running the game backwards. Every keyframe_interval frames a whole state is kept, and
+// the frames in between are kept as just what changed since that keyframe (XORed against it, so unchanged bytes are zeroes, then
+// run length encoded). Most of a state is the same from frame to frame, so a delta is usually a few hundred bytes
+// Everything lives in an arena that's allocated up front. It's used as a ring - once it's full, or there are as many frames as
+// asked for, the oldest keyframe and its deltas are dropped to make room - so capturing a frame never allocates
+class RewindBuffer {
+
+    private:
+        struct Entry {
+            // Where the compressed state is in the arena
+            size_t offset;
+            size_t size;
+            // Index of the keyframe this was diffed against
+            int key;
+            // Frames since that keyframe (0 for keyframes themselves)
+            int since_key;
+        };
+
+        size_t state_size;
+        int keyframe_interval;
+        std::vector<uint8_t> arena;
+        // Ring of what's in the arena, oldest to newest
+        std::vector<Entry> entries;
+        int oldest;
+        int count;
+        size_t bytes_used;
+        // The keyframe new frames are diffed against, uncompressed, and its index - or -1 if there's none, in which case the next
+        // frame becomes one
+        std::vector<uint8_t> key_state;
+        int key_entry;
+        // Keyframes are "diffed" against this, so they're compressed the same way as everything else
+        std::vector<uint8_t> zeroes;
+        // A compressed state is built here before it's known where it'll fit in the arena
+        std::vector<uint8_t> scratch;
+
+        int newest() const;
+        size_t compress(const uint8_t* state, const uint8_t* base, uint8_t* out) const;
+        void decompress(const uint8_t* in, const uint8_t* base, uint8_t* state) const;
+        bool find_room(size_t size, size_t& offset) const;
+        void drop_oldest_group();
+
+    public:
+        // state_size is what NES::get_state_size says. frames is how much history to keep, as long as it fits in arena_size bytes
+        RewindBuffer(size_t state_size, int frames, size_t arena_size, int keyframe_interval = 30);
+
+        // Adds a state as the newest frame
+        void push(const uint8_t* state);
+        // Takes the newest frame off and writes its state out. Returns false if there's nothing left to go back to
+        bool pop(uint8_t* state);
+        void clear();
+
+        int get_frames() const;
+        // Compressed size of everything that's kept (the arena itself is always arena_size)
+        size_t get_bytes_used() const;
+        // How much a minute of history takes up, going by what's kept right now
+        double get_bytes_per_minute() const;
+
+};
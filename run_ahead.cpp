@@ -0,0 +1,61 @@
+#include "run_ahead.h"
+
+RunAheadWorker::RunAheadWorker(FramePresenter* presenter, const NES& source) : presenter(presenter) {
+    // The one full copy, for the ROM - after this only the state changes
+    nes.load_state(source);
+    state.resize(nes.get_state_size());
+    frames = 0;
+    quitting = false;
+    presented_hash = 0;
+    nes.ppu.set_frame_target(presenter->get_back_buffer(), presenter->get_pitch());
+    worker = std::thread(&RunAheadWorker::worker_loop, this);
+}
+
+RunAheadWorker::~RunAheadWorker() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quitting = true;
+    }
+    work_ready.notify_all();
+    worker.join();
+}
+
+void RunAheadWorker::submit(const NES& source, int frames) {
+    std::unique_lock<std::mutex> lock(mutex);
+    work_done.wait(lock, [this] { return this->frames == 0; });
+    source.save_state(state.data(), state.size());
+    this->frames = frames;
+    lock.unlock();
+    work_ready.notify_one();
+}
+
+void RunAheadWorker::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    work_done.wait(lock, [this] { return frames == 0; });
+}
+
+void RunAheadWorker::worker_loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        work_ready.wait(lock, [this] { return quitting || frames > 0; });
+        if (quitting) return;
+        int count = frames;
+        lock.unlock();
+
+        nes.load_state(state.data(), state.size());
+        // Only the last frame is ever seen, so that's the only one drawn
+        nes.ppu.set_frameskip(0);
+        for (int i = 1; i < count; i++) nes.run_frame();
+        nes.ppu.set_frameskip(1);
+        nes.run_frame();
+        if (nes.ppu.get_frame_hash() != presented_hash) {
+            presented_hash = nes.ppu.get_frame_hash();
+            presenter->publish();
+            nes.ppu.set_frame_target(presenter->get_back_buffer(), presenter->get_pitch());
+        }
+
+        lock.lock();
+        frames = 0;
+        work_done.notify_all();
+    }
+}
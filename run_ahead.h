@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "nes.h"
+#include "presenter.h"
+
+// Second instance run-ahead: the speculative frames are run on a copy of the console on another core, so they don't come out of
+// the emulation thread's frame budget. Each frame, emulation runs the real frame and hands its state over with submit(); this
+// runs that many frames further ahead with the same input and publishes the last one to the presenter. Only frames that will
+// be shown get handed over, so while fast forwarding most real frames never come through here
+// The state goes over serialized (see NES::save_state) rather than by copying the whole console, which would drag the PPU's frame
+// buffer and all of the CPU's memory along with it
+class RunAheadWorker {
+
+    private:
+        NES nes;
+        FramePresenter* presenter;
+        // The state that was handed over. Only submit() writes it, and only while the worker isn't reading it
+        std::vector<uint8_t> state;
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable work_ready;
+        std::condition_variable work_done;
+        // Frames to run ahead for the state that was handed over, or 0 once that's done
+        int frames;
+        bool quitting;
+        uint64_t presented_hash;
+
+        void worker_loop();
+
+    public:
+        // Only frames drawn straight into the presenter are supported (no filters). Takes source's ROM, so source has to outlive
+        // this
+        RunAheadWorker(FramePresenter* presenter, const NES& source);
+        ~RunAheadWorker();
+
+        // Saves source's state and starts running frames ahead of it. Waits for the last lot to finish first, which only happens
+        // if this core can't keep up
+        void submit(const NES& source, int frames);
+        void wait();
+
+};
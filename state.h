@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+// Every state starts with this, so a state can be checked before anything is loaded from it. Bump STATE_VERSION whenever anything
+// is added to, removed from or moved around in a state - old states are turned away rather than loaded wrong
+struct StateHeader {
+    char magic[4];
+    uint32_t version;
+    // Of the whole state, this included
+    uint32_t size;
+    int32_t mapper;
+    // See NES::get_rom_hash - a state only makes sense with the ROM it came from
+    uint64_t rom_hash;
+};
+
+static constexpr char STATE_MAGIC[4] = {'S', 'N', 'S', 'T'};
+static constexpr uint32_t STATE_VERSION = 2;
+
+// Save states are written field by field into a buffer the caller already has, so saving never allocates and is cheap enough to
+// do every frame (rewind does). Fields go in as their raw bytes, so a state file only loads on a machine with the same byte order
+// (in practice, anything little endian)
+class StateWriter {
+
+    private:
+        uint8_t* data;
+        size_t capacity;
+        size_t position;
+
+    public:
+        // With no buffer, nothing is written and this just counts up how big the state would be
+        StateWriter(uint8_t* data = nullptr, size_t capacity = 0) : data(data), capacity(capacity), position(0) {}
+
+        void write_bytes(const void* bytes, size_t size) {
+            if (data && position + size <= capacity) std::memcpy(data + position, bytes, size);
+            position += size;
+        }
+
+        template <typename T>
+        void write(const T& value) {
+            static_assert(std::is_trivially_copyable<T>::value, "only plain values can go into a state");
+            write_bytes(&value, sizeof(T));
+        }
+
+        // Bytes written so far (or that would have been, if they didn't fit)
+        size_t size() const { return position; }
+        // False if the state didn't fit in the buffer
+        bool fits() const { return data && position <= capacity; }
+
+};
+
+// Reads a state back out in the same order StateWriter wrote it. Reading past the end gives zeroes and marks the read as failed,
+// so a truncated state can be caught once at the end instead of after every field
+class StateReader {
+
+    private:
+        const uint8_t* data;
+        size_t capacity;
+        size_t position;
+
+    public:
+        StateReader(const uint8_t* data, size_t capacity) : data(data), capacity(capacity), position(0) {}
+
+        void read_bytes(void* bytes, size_t size) {
+            if (position + size <= capacity) std::memcpy(bytes, data + position, size);
+            else std::memset(bytes, 0, size);
+            position += size;
+        }
+
+        template <typename T>
+        void read(T& value) {
+            static_assert(std::is_trivially_copyable<T>::value, "only plain values can come out of a state");
+            read_bytes(&value, sizeof(T));
+        }
+
+        size_t size() const { return position; }
+        bool ok() const { return position <= capacity; }
+
+};
@@ -0,0 +1,197 @@
+#include "tile_decode.h"
+#include <cstring>
+#include <vector>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define TILE_DECODE_X86 1
+#include <immintrin.h>
+#endif
+
+// Scalar versions
+
+// Spreads the 8 bits of a byte out so that bit n ends up at bit 4n
+static uint32_t spread_nibbles(uint8_t byte) {
+    uint32_t x = byte;
+    x = (x | (x << 12)) & 0x000F000F;
+    x = (x | (x << 6)) & 0x03030303;
+    x = (x | (x << 3)) & 0x11111111;
+    return x;
+}
+
+uint32_t decode_tile_row_scalar(uint8_t low, uint8_t high) { return spread_nibbles(low) | (spread_nibbles(high) << 1); }
+
+void decode_tile_rows_scalar(const uint8_t* low, const uint8_t* high, const uint8_t* palette, uint8_t* out, int count) {
+    for (int i = 0; i < count; i++) {
+        uint8_t attribute = (palette[i] & 3) << 2;
+        for (int pixel = 0; pixel < 8; pixel++) {
+            int bit = 7 - pixel;
+            out[i * 8 + pixel] = attribute | (((high[i] >> bit) & 1) << 1) | ((low[i] >> bit) & 1);
+        }
+    }
+}
+
+#ifdef TILE_DECODE_X86
+
+// Every byte of the result is the given byte
+static inline uint64_t broadcast(uint8_t byte) { return byte * 0x0101010101010101ULL; }
+
+// With BMI2, pdep drops each bit straight into place
+__attribute__((target("bmi2")))
+static uint32_t decode_tile_row_bmi2(uint8_t low, uint8_t high) {
+    return _pdep_u32(low, 0x11111111) | _pdep_u32(high, 0x22222222);
+}
+
+// pdep puts bit n in byte n, but we want bit 7 (the leftmost pixel) in byte 0, hence the byte swap
+__attribute__((target("bmi2")))
+static void decode_tile_rows_bmi2(const uint8_t* low, const uint8_t* high, const uint8_t* palette, uint8_t* out, int count) {
+    for (int i = 0; i < count; i++) {
+        uint64_t pixels = _pdep_u64(low[i], 0x0101010101010101ULL) | _pdep_u64(high[i], 0x0202020202020202ULL);
+        pixels = __builtin_bswap64(pixels) | broadcast((palette[i] & 3) << 2);
+        std::memcpy(out + i * 8, &pixels, 8);
+    }
+}
+
+// The SIMD versions broadcast each bitplane byte across the 8 bytes for its row, then test one bit per byte with a mask
+__attribute__((target("sse2")))
+static void decode_tile_rows_sse2(const uint8_t* low, const uint8_t* high, const uint8_t* palette, uint8_t* out, int count) {
+    const __m128i bits = _mm_set_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char) 0x80,
+                                      0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char) 0x80);
+    const __m128i ones = _mm_set1_epi8(1);
+    const __m128i twos = _mm_set1_epi8(2);
+
+    int i = 0;
+    // 2 rows at a time
+    for (; i + 2 <= count; i += 2) {
+        __m128i l = _mm_set_epi64x(broadcast(low[i + 1]), broadcast(low[i]));
+        __m128i h = _mm_set_epi64x(broadcast(high[i + 1]), broadcast(high[i]));
+        __m128i p = _mm_set_epi64x(broadcast((palette[i + 1] & 3) << 2), broadcast((palette[i] & 3) << 2));
+
+        __m128i l_set = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(l, bits), bits), ones);
+        __m128i h_set = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(h, bits), bits), twos);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 8), _mm_or_si128(_mm_or_si128(l_set, h_set), p));
+    }
+    decode_tile_rows_scalar(low + i, high + i, palette + i, out + i * 8, count - i);
+}
+
+__attribute__((target("avx2")))
+static void decode_tile_rows_avx2(const uint8_t* low, const uint8_t* high, const uint8_t* palette, uint8_t* out, int count) {
+    const __m256i bits = _mm256_set1_epi64x(0x0102040810204080LL);
+    const __m256i ones = _mm256_set1_epi8(1);
+    const __m256i twos = _mm256_set1_epi8(2);
+
+    int i = 0;
+    // 4 rows at a time
+    for (; i + 4 <= count; i += 4) {
+        __m256i l = _mm256_set_epi64x(broadcast(low[i + 3]), broadcast(low[i + 2]), broadcast(low[i + 1]), broadcast(low[i]));
+        __m256i h = _mm256_set_epi64x(broadcast(high[i + 3]), broadcast(high[i + 2]), broadcast(high[i + 1]), broadcast(high[i]));
+        __m256i p = _mm256_set_epi64x(broadcast((palette[i + 3] & 3) << 2), broadcast((palette[i + 2] & 3) << 2),
+                                      broadcast((palette[i + 1] & 3) << 2), broadcast((palette[i] & 3) << 2));
+
+        __m256i l_set = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(l, bits), bits), ones);
+        __m256i h_set = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(h, bits), bits), twos);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i * 8), _mm256_or_si256(_mm256_or_si256(l_set, h_set), p));
+    }
+    decode_tile_rows_sse2(low + i, high + i, palette + i, out + i * 8, count - i);
+}
+
+#endif
+
+// Runtime selection
+
+typedef uint32_t (*RowKernel)(uint8_t, uint8_t);
+typedef void (*RowsKernel)(const uint8_t*, const uint8_t*, const uint8_t*, uint8_t*, int);
+
+struct TileDecodeKernels {
+    RowKernel row;
+    RowsKernel rows;
+    const char* name;
+};
+
+// AVX2 is preferred for bulk decoding since it does 4 rows per step; pdep is the fastest way to do a single row
+static TileDecodeKernels pick_kernels() {
+    TileDecodeKernels kernels = {decode_tile_row_scalar, decode_tile_rows_scalar, "scalar"};
+#ifdef TILE_DECODE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("bmi2")) {
+        kernels.row = decode_tile_row_bmi2;
+        kernels.rows = decode_tile_rows_bmi2;
+        kernels.name = "bmi2";
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.rows = decode_tile_rows_avx2;
+        kernels.name = "avx2";
+    }
+    else if (kernels.rows == decode_tile_rows_scalar && __builtin_cpu_supports("sse2")) {
+        kernels.rows = decode_tile_rows_sse2;
+        kernels.name = "sse2";
+    }
+#endif
+    return kernels;
+}
+
+static const TileDecodeKernels kernels = pick_kernels();
+
+uint32_t decode_tile_row(uint8_t low, uint8_t high) { return kernels.row(low, high); }
+
+void decode_tile_rows(const uint8_t* low, const uint8_t* high, const uint8_t* palette, uint8_t* out, int count) {
+    kernels.rows(low, high, palette, out, count);
+}
+
+const char* tile_decode_kernel_name() { return kernels.name; }
+
+// Self test
+
+static bool check_rows(RowsKernel kernel, const std::vector<uint8_t>& low, const std::vector<uint8_t>& high,
+                       const std::vector<uint8_t>& palette, const std::vector<uint8_t>& expected) {
+    int count = (int) low.size();
+    std::vector<uint8_t> out(expected.size(), 0xFF);
+    kernel(low.data(), high.data(), palette.data(), out.data(), count);
+    if (out != expected) return false;
+
+    // Odd sized batches, like a 33 tile scanline, to exercise the leftover handling
+    for (int start = 0; start + 33 <= count; start += 4099) {
+        std::fill(out.begin(), out.end(), 0xFF);
+        kernel(low.data() + start, high.data() + start, palette.data() + start, out.data(), 33);
+        if (std::memcmp(out.data(), expected.data() + start * 8, 33 * 8) != 0) return false;
+    }
+    return true;
+}
+
+bool tile_decode_self_test() {
+    // Every combination of low byte, high byte and palette
+    std::vector<uint8_t> low, high, palette;
+    for (int p = 0; p < 4; p++) {
+        for (int h = 0; h < 256; h++) {
+            for (int l = 0; l < 256; l++) {
+                low.push_back(l);
+                high.push_back(h);
+                palette.push_back(p);
+            }
+        }
+    }
+    std::vector<uint8_t> expected(low.size() * 8);
+    decode_tile_rows_scalar(low.data(), high.data(), palette.data(), expected.data(), (int) low.size());
+
+    // The packed scalar version has to agree with the plain one too
+    for (size_t i = 0; i < 65536; i++) {
+        uint32_t packed = decode_tile_row_scalar(low[i], high[i]);
+        for (int pixel = 0; pixel < 8; pixel++) {
+            if (((packed >> (4 * (7 - pixel))) & 0xF) != expected[i * 8 + pixel]) return false;
+        }
+    }
+
+    if (!check_rows(decode_tile_rows, low, high, palette, expected)) return false;
+
+#ifdef TILE_DECODE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2") && !check_rows(decode_tile_rows_sse2, low, high, palette, expected)) return false;
+    if (__builtin_cpu_supports("avx2") && !check_rows(decode_tile_rows_avx2, low, high, palette, expected)) return false;
+    if (__builtin_cpu_supports("bmi2")) {
+        if (!check_rows(decode_tile_rows_bmi2, low, high, palette, expected)) return false;
+        for (size_t i = 0; i < 65536; i++) {
+            if (decode_tile_row_bmi2(low[i], high[i]) != decode_tile_row_scalar(low[i], high[i])) return false;
+        }
+    }
+#endif
+    return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+
+// Tile row decoding - turning the two bitplanes of a pattern table row into pixels
+// A row of a tile is two bytes: the low bitplane and the high bitplane. Bit 7 of each is the leftmost pixel, and pixel n's 2 bit
+// value is (high bit n << 1) | low bit n. Doing this one bit at a time is slow, so these do whole rows at once. Which version gets
+// used (scalar, SSE2, AVX2, BMI2) is picked at runtime based on what the CPU supports
+
+// Decodes one row into 8 pixels packed 4 bits each, leftmost pixel in the top nibble. Only the low 2 bits of each nibble are
+// used; this lines up with the PPU's pixel shift register, which keeps the palette bits in the top 2 bits of each nibble
+uint32_t decode_tile_row(uint8_t low, uint8_t high);
+
+// Decodes count rows into 8 bytes each, leftmost pixel first. Each byte is (palette << 2) | pixel - i.e. an index into the
+// 0x3F00 palette RAM. palette[i] is the 2 bit attribute for row i. This is enough for a whole scanline (33 tiles) in one call
+void decode_tile_rows(const uint8_t* low, const uint8_t* high, const uint8_t* palette, uint8_t* out, int count);
+
+// Plain versions of the above that the vectorized ones are checked against
+uint32_t decode_tile_row_scalar(uint8_t low, uint8_t high);
+void decode_tile_rows_scalar(const uint8_t* low, const uint8_t* high, const uint8_t* palette, uint8_t* out, int count);
+
+// Name of the version of decode_tile_rows in use
+const char* tile_decode_kernel_name();
+
+// Runs every available version against the scalar ones over every possible row and palette and returns true if they all match
+bool tile_decode_self_test();
@@ -0,0 +1,400 @@
+#include "video_filter.h"
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Scale2x/Scale3x (also known as AdvMAME2x/3x)
+// Each pixel E is blown up into a 2x2 or 3x3 block. With the neighbours laid out as
+//   A B C
+//   D E F
+//   G H I
+// a corner of the block takes on the color of the two neighbours next to it if they match (and the ones across from them don't),
+// which rounds off diagonal edges without ever making up new colors
+
+static inline const uint32_t* row_at(const uint32_t* src, int y) { return src + std::min(std::max(y, 0), 239) * 256; }
+
+static inline void scale2x_pixel(uint32_t b, uint32_t d, uint32_t e, uint32_t f, uint32_t h, uint32_t* out0, uint32_t* out1) {
+    if (b != h && d != f) {
+        out0[0] = d == b ? d : e;
+        out0[1] = b == f ? f : e;
+        out1[0] = d == h ? d : e;
+        out1[1] = h == f ? f : e;
+    }
+    else {
+        out0[0] = out0[1] = out1[0] = out1[1] = e;
+    }
+}
+
+static void scale2x(const uint32_t* src, uint32_t* dst, int pitch, int row_begin, int row_end) {
+    for (int y = row_begin; y < row_end; y++) {
+        const uint32_t* above = row_at(src, y - 1);
+        const uint32_t* row = row_at(src, y);
+        const uint32_t* below = row_at(src, y + 1);
+        uint32_t* out0 = dst + 2 * (y - row_begin) * pitch;
+        uint32_t* out1 = out0 + pitch;
+
+        // The edges repeat the border pixels
+        scale2x_pixel(above[0], row[0], row[0], row[1], below[0], out0, out1);
+        int x = 1;
+#ifdef __SSE2__
+        // 4 pixels at a time - the rules above are just compares and selects, so they work lane by lane
+        for (; x + 4 <= 255; x += 4) {
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x));
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1));
+            __m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+            __m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x + 1));
+            __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(below + x));
+
+            __m128i db = _mm_cmpeq_epi32(d, b);
+            __m128i bf = _mm_cmpeq_epi32(b, f);
+            __m128i dh = _mm_cmpeq_epi32(d, h);
+            __m128i hf = _mm_cmpeq_epi32(h, f);
+            // Same as b != h && d != f, but in terms of the compares we already have
+            __m128i bh = _mm_cmpeq_epi32(b, h);
+            __m128i df = _mm_cmpeq_epi32(d, f);
+            __m128i active = _mm_andnot_si128(_mm_or_si128(bh, df), _mm_set1_epi32(-1));
+
+            __m128i m0 = _mm_and_si128(active, db);
+            __m128i m1 = _mm_and_si128(active, bf);
+            __m128i m2 = _mm_and_si128(active, dh);
+            __m128i m3 = _mm_and_si128(active, hf);
+            __m128i e0 = _mm_or_si128(_mm_and_si128(m0, d), _mm_andnot_si128(m0, e));
+            __m128i e1 = _mm_or_si128(_mm_and_si128(m1, f), _mm_andnot_si128(m1, e));
+            __m128i e2 = _mm_or_si128(_mm_and_si128(m2, d), _mm_andnot_si128(m2, e));
+            __m128i e3 = _mm_or_si128(_mm_and_si128(m3, f), _mm_andnot_si128(m3, e));
+
+            // Interleave so each pixel's two output columns end up next to each other
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out0 + 2 * x), _mm_unpacklo_epi32(e0, e1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out0 + 2 * x + 4), _mm_unpackhi_epi32(e0, e1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out1 + 2 * x), _mm_unpacklo_epi32(e2, e3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out1 + 2 * x + 4), _mm_unpackhi_epi32(e2, e3));
+        }
+#endif
+        for (; x < 255; x++) scale2x_pixel(above[x], row[x - 1], row[x], row[x + 1], below[x], out0 + 2 * x, out1 + 2 * x);
+        scale2x_pixel(above[255], row[254], row[255], row[255], below[255], out0 + 510, out1 + 510);
+    }
+}
+
+static inline void scale3x_pixel(uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t e, uint32_t f, uint32_t g, uint32_t h,
+                                 uint32_t i, uint32_t* o0, uint32_t* o1, uint32_t* o2) {
+    if (b != h && d != f) {
+        o0[0] = d == b ? d : e;
+        o0[1] = (d == b && e != c) || (b == f && e != a) ? b : e;
+        o0[2] = b == f ? f : e;
+        o1[0] = (d == b && e != g) || (d == h && e != a) ? d : e;
+        o1[1] = e;
+        o1[2] = (b == f && e != i) || (h == f && e != c) ? f : e;
+        o2[0] = d == h ? d : e;
+        o2[1] = (d == h && e != i) || (h == f && e != g) ? h : e;
+        o2[2] = h == f ? f : e;
+    }
+    else {
+        o0[0] = o0[1] = o0[2] = o1[0] = o1[1] = o1[2] = o2[0] = o2[1] = o2[2] = e;
+    }
+}
+
+#ifdef __SSE2__
+static inline __m128i select_lanes(__m128i mask, __m128i yes, __m128i no) {
+    return _mm_or_si128(_mm_and_si128(mask, yes), _mm_andnot_si128(mask, no));
+}
+
+// Writes 4 pixels' worth of 3 output columns (p, q, r) as p0 q0 r0 p1 q1 r1 ... - SSE2 has no 3 way interleave, so it's built out
+// of two 2 way ones and a shuffle for each group of 4
+static inline void store_interleaved3(uint32_t* out, __m128i p, __m128i q, __m128i r) {
+    __m128 pq_lo = _mm_castsi128_ps(_mm_unpacklo_epi32(p, q));
+    __m128 pq_hi = _mm_castsi128_ps(_mm_unpackhi_epi32(p, q));
+    __m128 qr_lo = _mm_castsi128_ps(_mm_unpacklo_epi32(q, r));
+    __m128 qr_hi = _mm_castsi128_ps(_mm_unpackhi_epi32(q, r));
+    __m128 rp_lo = _mm_castsi128_ps(_mm_unpacklo_epi32(r, p));
+    __m128 rp_hi = _mm_castsi128_ps(_mm_unpackhi_epi32(r, p));
+    _mm_storeu_ps(reinterpret_cast<float*>(out), _mm_shuffle_ps(pq_lo, rp_lo, _MM_SHUFFLE(3, 0, 1, 0)));
+    _mm_storeu_ps(reinterpret_cast<float*>(out + 4), _mm_shuffle_ps(qr_lo, pq_hi, _MM_SHUFFLE(1, 0, 3, 2)));
+    _mm_storeu_ps(reinterpret_cast<float*>(out + 8), _mm_shuffle_ps(rp_hi, qr_hi, _MM_SHUFFLE(3, 2, 3, 0)));
+}
+#endif
+
+static void scale3x(const uint32_t* src, uint32_t* dst, int pitch, int row_begin, int row_end) {
+    for (int y = row_begin; y < row_end; y++) {
+        const uint32_t* above = row_at(src, y - 1);
+        const uint32_t* row = row_at(src, y);
+        const uint32_t* below = row_at(src, y + 1);
+        uint32_t* out0 = dst + 3 * (y - row_begin) * pitch;
+        uint32_t* out1 = out0 + pitch;
+        uint32_t* out2 = out1 + pitch;
+
+        scale3x_pixel(above[0], above[0], above[1], row[0], row[0], row[1], below[0], below[0], below[1], out0, out1, out2);
+        int x = 1;
+#ifdef __SSE2__
+        // Same as Scale2x's, with the extra rules for the edge centres
+        for (; x + 4 <= 255; x += 4) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x - 1));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x));
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x + 1));
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1));
+            __m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+            __m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x + 1));
+            __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(below + x - 1));
+            __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(below + x));
+            __m128i i = _mm_loadu_si128(reinterpret_cast<const __m128i*>(below + x + 1));
+
+            __m128i active = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f)), _mm_set1_epi32(-1));
+            __m128i db = _mm_and_si128(active, _mm_cmpeq_epi32(d, b));
+            __m128i bf = _mm_and_si128(active, _mm_cmpeq_epi32(b, f));
+            __m128i dh = _mm_and_si128(active, _mm_cmpeq_epi32(d, h));
+            __m128i hf = _mm_and_si128(active, _mm_cmpeq_epi32(h, f));
+            __m128i ea = _mm_cmpeq_epi32(e, a);
+            __m128i ec = _mm_cmpeq_epi32(e, c);
+            __m128i eg = _mm_cmpeq_epi32(e, g);
+            __m128i ei = _mm_cmpeq_epi32(e, i);
+
+            // (x && !y) is _mm_andnot_si128(y, x)
+            __m128i top = _mm_or_si128(_mm_andnot_si128(ec, db), _mm_andnot_si128(ea, bf));
+            __m128i left = _mm_or_si128(_mm_andnot_si128(eg, db), _mm_andnot_si128(ea, dh));
+            __m128i right = _mm_or_si128(_mm_andnot_si128(ei, bf), _mm_andnot_si128(ec, hf));
+            __m128i bottom = _mm_or_si128(_mm_andnot_si128(ei, dh), _mm_andnot_si128(eg, hf));
+
+            store_interleaved3(out0 + 3 * x, select_lanes(db, d, e), select_lanes(top, b, e), select_lanes(bf, f, e));
+            store_interleaved3(out1 + 3 * x, select_lanes(left, d, e), e, select_lanes(right, f, e));
+            store_interleaved3(out2 + 3 * x, select_lanes(dh, d, e), select_lanes(bottom, h, e), select_lanes(hf, f, e));
+        }
+#endif
+        for (; x < 255; x++) {
+            scale3x_pixel(above[x - 1], above[x], above[x + 1], row[x - 1], row[x], row[x + 1], below[x - 1], below[x], below[x + 1],
+                          out0 + 3 * x, out1 + 3 * x, out2 + 3 * x);
+        }
+        scale3x_pixel(above[254], above[255], above[255], row[254], row[255], row[255], below[254], below[255], below[255],
+                      out0 + 765, out1 + 765, out2 + 765);
+    }
+}
+
+// 2xBR (level 1)
+// xBR looks at a 5x5 neighbourhood to decide whether an edge runs through each corner of a pixel, by comparing how much the colors
+// change along each diagonal. If there's an edge, that corner is blended with the neighbour on the other side of it
+
+static inline uint32_t blend_half(uint32_t p, uint32_t q) {
+    return ((p & 0xFEFEFEFE) >> 1) + ((q & 0xFEFEFEFE) >> 1) + (p & q & 0x01010101);
+}
+
+// A band of the frame with 2 pixels of padding on every side (copied from the edge) so nothing has to be clamped, along with the
+// YUV of every pixel. Color distances get worked out a lot, so converting each pixel once up front saves a ton of time
+struct YuvBand {
+    static const int WIDTH = 256 + 4;
+    std::vector<uint32_t> pixels;
+    std::vector<int> y, u, v;
+
+    void load(const uint32_t* src, int row_begin, int row_end) {
+        int rows = row_end - row_begin + 4;
+        pixels.resize(rows * WIDTH);
+        y.resize(rows * WIDTH);
+        u.resize(rows * WIDTH);
+        v.resize(rows * WIDTH);
+        for (int row = 0; row < rows; row++) {
+            const uint32_t* src_row = row_at(src, row_begin + row - 2);
+            for (int x = 0; x < WIDTH; x++) {
+                int index = row * WIDTH + x;
+                uint32_t p = src_row[std::min(std::max(x - 2, 0), 255)];
+                pixels[index] = p;
+                // The PPU writes blue to the lowest byte
+                int b = p & 0xFF, g = (p >> 8) & 0xFF, r = (p >> 16) & 0xFF;
+                y[index] = 299 * r + 587 * g + 114 * b;
+                u[index] = -169 * r - 331 * g + 500 * b;
+                v[index] = 500 * r - 419 * g - 81 * b;
+            }
+        }
+    }
+
+    // Perceptual distance between two pixels, weighted like the original
+    int distance(int p, int q) const { return 48 * std::abs(y[p] - y[q]) + 7 * std::abs(u[p] - u[q]) + 6 * std::abs(v[p] - v[q]); }
+
+    // HQ2x's test for whether two pixels count as different colors. Its thresholds are 48, 7 and 6 out of 255, and the YUV here
+    // is 1000 times that scale
+    bool differs(int p, int q) const {
+        return std::abs(y[p] - y[q]) > 48000 || std::abs(u[p] - u[q]) > 7000 || std::abs(v[p] - v[q]) > 6000;
+    }
+
+    // Works out the corner of pixel e that faces (dx, dy), where those are the index steps to the neighbour in that direction
+    // (+-1 and +-WIDTH). Written in terms of the bottom right corner - the others are just mirror images of it
+    uint32_t corner(int e, int dx, int dy) const {
+        int f = e + dx, h = e + dy;
+        if (pixels[e] == pixels[f] || pixels[e] == pixels[h]) return pixels[e];
+
+        int i = e + dx + dy;
+        int b = e - dy, d = e - dx;
+        int c = e + dx - dy, g = e - dx + dy;
+        int f4 = e + 2 * dx, h5 = e + 2 * dy;
+        int i4 = e + 2 * dx + dy, i5 = e + dx + 2 * dy;
+
+        // How much the colors change crossing the e-i diagonal vs crossing the f-h one
+        int across = distance(e, c) + distance(e, g) + distance(i, f4) + distance(i, h5) + 4 * distance(h, f);
+        int along = distance(h, d) + distance(h, i5) + distance(f, i4) + distance(f, b) + 4 * distance(e, i);
+        if (across >= along) return pixels[e];
+
+        uint32_t closer = distance(e, f) <= distance(e, h) ? pixels[f] : pixels[h];
+        return blend_half(pixels[e], closer);
+    }
+};
+
+static void xbr2x(const uint32_t* src, uint32_t* dst, int pitch, int row_begin, int row_end) {
+    // Each worker keeps its own so it isn't reallocated every frame
+    thread_local YuvBand band;
+    band.load(src, row_begin, row_end);
+
+    const int w = YuvBand::WIDTH;
+    for (int y = row_begin; y < row_end; y++) {
+        uint32_t* out0 = dst + 2 * (y - row_begin) * pitch;
+        uint32_t* out1 = out0 + pitch;
+        int e = (y - row_begin + 2) * w + 2;
+        for (int x = 0; x < 256; x++, e++) {
+            out0[2 * x] = band.corner(e, -1, -w);
+            out0[2 * x + 1] = band.corner(e, 1, -w);
+            out1[2 * x] = band.corner(e, -1, w);
+            out1[2 * x + 1] = band.corner(e, 1, w);
+        }
+    }
+}
+
+// HQ2x
+// Every neighbour of E is marked as similar to it or not (by YUV distance, see YuvBand::differs), and each corner of the 2x2 block
+// is then a weighted mix of E and the three neighbours touching that corner, with the weights picked by which of them (and the two
+// beyond them along the block's edges) are different. The original does this with a 256 case switch covering all four corners;
+// here the rules are written once for the top left corner and the others just hand in their own neighbours, mirrored. The blends
+// are the same kind as the original's, but the rules aren't a copy of its table, so the output isn't bit exact with it
+
+// Weights out of 16 for E, the diagonal neighbour and the ones above/below and to the side
+struct Hq2xRule {
+    uint8_t e, diagonal, vertical, horizontal;
+};
+
+// Indexed by which of diagonal, vertical, horizontal, the far vertical one and the far horizontal one differ from E (bits 0 - 4),
+// plus bit 5 if the vertical and horizontal neighbours are similar to each other - meaning an edge runs diagonally across the corner
+struct Hq2xRules {
+    static const int DIAGONAL = 1, VERTICAL = 2, HORIZONTAL = 4, FAR_VERTICAL = 8, FAR_HORIZONTAL = 16, EDGE = 32;
+    Hq2xRule rules[64];
+
+    Hq2xRules() {
+        for (int i = 0; i < 64; i++) {
+            bool diagonal = i & DIAGONAL, vertical = i & VERTICAL, horizontal = i & HORIZONTAL;
+            Hq2xRule& rule = rules[i];
+            // Neither side differs - a soft blend, everything involved is close to E anyway
+            if (!vertical && !horizontal) rule = {8, 0, 4, 4};
+            // A straight edge along one side stays sharp, only picking up a little of the pixel on E's side of it
+            else if (vertical && !horizontal) rule = diagonal ? Hq2xRule{12, 0, 0, 4} : Hq2xRule{8, 4, 0, 4};
+            else if (horizontal && !vertical) rule = diagonal ? Hq2xRule{12, 0, 4, 0} : Hq2xRule{8, 4, 4, 0};
+            // Both sides differ but not from each other - E is on the outside of a diagonal edge, so the corner gets rounded off.
+            // Less so if the edge carries on past the far neighbours (E is a point sticking out, or the edge is closer to
+            // horizontal or vertical than diagonal)
+            else if (i & EDGE) {
+                if (!diagonal) rule = {8, 0, 4, 4};
+                else if ((i & FAR_VERTICAL) && (i & FAR_HORIZONTAL)) rule = {12, 0, 2, 2};
+                else if (i & FAR_VERTICAL) rule = {10, 0, 4, 2};
+                else if (i & FAR_HORIZONTAL) rule = {10, 0, 2, 4};
+                else rule = {8, 0, 4, 4};
+            }
+            // Both sides differ from E and from each other - leave E alone
+            else rule = diagonal ? Hq2xRule{16, 0, 0, 0} : Hq2xRule{12, 4, 0, 0};
+        }
+    }
+};
+
+static const Hq2xRules hq2x_rules;
+
+// Mixes the four pixels a channel at a time, two channels per 32 bit add (the weights add up to 16, so nothing carries over)
+static inline uint32_t hq2x_mix(const Hq2xRule& rule, uint32_t e, uint32_t diagonal, uint32_t vertical, uint32_t horizontal) {
+    uint32_t rb = rule.e * (e & 0x00FF00FF) + rule.diagonal * (diagonal & 0x00FF00FF) + rule.vertical * (vertical & 0x00FF00FF) +
+                  rule.horizontal * (horizontal & 0x00FF00FF);
+    uint32_t ag = rule.e * ((e >> 8) & 0x00FF00FF) + rule.diagonal * ((diagonal >> 8) & 0x00FF00FF) +
+                  rule.vertical * ((vertical >> 8) & 0x00FF00FF) + rule.horizontal * ((horizontal >> 8) & 0x00FF00FF);
+    return ((rb >> 4) & 0x00FF00FF) | ((ag << 4) & 0xFF00FF00);
+}
+
+static void hq2x(const uint32_t* src, uint32_t* dst, int pitch, int row_begin, int row_end) {
+    thread_local YuvBand band;
+    band.load(src, row_begin, row_end);
+
+    const int w = YuvBand::WIDTH;
+    const std::vector<uint32_t>& pixels = band.pixels;
+    for (int y = row_begin; y < row_end; y++) {
+        uint32_t* out0 = dst + 2 * (y - row_begin) * pitch;
+        uint32_t* out1 = out0 + pitch;
+        int e = (y - row_begin + 2) * w + 2;
+        for (int x = 0; x < 256; x++, e++) {
+            // Neighbours numbered like a phone keypad: 1 2 3 above, 4 (E) 6 either side, 7 8 9 below
+            int n[10] = {0, e - w - 1, e - w, e - w + 1, e - 1, e, e + 1, e + w - 1, e + w, e + w + 1};
+            int differs = 0;
+            for (int i = 1; i <= 9; i++) if (i != 5 && band.differs(e, n[i])) differs |= 1 << i;
+
+            auto corner = [&](int diagonal, int vertical, int horizontal, int far_vertical, int far_horizontal) {
+                int index = (differs >> diagonal & 1) | (differs >> vertical & 1) << 1 | (differs >> horizontal & 1) << 2 |
+                            (differs >> far_vertical & 1) << 3 | (differs >> far_horizontal & 1) << 4;
+                if (!band.differs(n[vertical], n[horizontal])) index |= Hq2xRules::EDGE;
+                return hq2x_mix(hq2x_rules.rules[index], pixels[e], pixels[n[diagonal]], pixels[n[vertical]], pixels[n[horizontal]]);
+            };
+            out0[2 * x] = corner(1, 2, 4, 3, 7);
+            out0[2 * x + 1] = corner(3, 2, 6, 1, 9);
+            out1[2 * x] = corner(7, 8, 4, 9, 1);
+            out1[2 * x + 1] = corner(9, 8, 6, 7, 3);
+        }
+    }
+}
+
+// 2xBR and HQ2x are scalar: every pixel's result depends on a chain of data dependent comparisons and (for HQ2x) a table lookup,
+// which don't map onto lanes the way Scale2x/3x's compares and selects do
+#ifdef __SSE2__
+static const bool SSE2_KERNELS = true;
+#else
+static const bool SSE2_KERNELS = false;
+#endif
+
+static const FilterInfo filters[FILTER_COUNT] = {
+    {"none", 1, nullptr, false},
+    {"scale2x", 2, scale2x, SSE2_KERNELS},
+    {"scale3x", 3, scale3x, SSE2_KERNELS},
+    {"2xbr", 2, xbr2x, false},
+    {"hq2x-approx", 2, hq2x, false},
+};
+
+const FilterInfo* get_filter_info(int filter) {
+    if (filter <= FILTER_NONE || filter >= FILTER_COUNT) return nullptr;
+    return &filters[filter];
+}
+
+// Pipeline
+
+FilterPipeline::FilterPipeline(int filter, int threads) : pool(threads) {
+    info = get_filter_info(filter);
+    std::fill_n(&inputs[0][0], 2 * 256 * 240, 0);
+    current_input = 0;
+    src = nullptr;
+    dst = nullptr;
+    dst_pitch = 0;
+}
+
+uint8_t* FilterPipeline::get_input() { return reinterpret_cast<uint8_t*>(inputs[current_input]); }
+
+void FilterPipeline::submit(uint8_t* dest, int pitch) {
+    // The workers only read these once the pool hands them the bands, and the last frame's are all done by now
+    wait();
+    src = inputs[current_input];
+    dst = reinterpret_cast<uint32_t*>(dest);
+    dst_pitch = pitch / 4;
+    pool.start(BANDS, [this](int, int band) { filter_band(band); });
+    current_input = 1 - current_input;
+}
+
+void FilterPipeline::wait() { pool.wait(); }
+
+void FilterPipeline::filter_band(int band) {
+    int row_begin = band * 240 / BANDS;
+    int row_end = (band + 1) * 240 / BANDS;
+    info->kernel(src, dst + row_begin * info->scale * dst_pitch, dst_pitch, row_begin, row_end);
+}
+
+int FilterPipeline::get_width() const { return 256 * info->scale; }
+
+int FilterPipeline::get_height() const { return 240 * info->scale; }
+
+const char* FilterPipeline::get_name() const { return info->name; }
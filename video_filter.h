@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include "work_pool.h"
+
+// Post-processing filters that scale the PPU's 256x240 frame up for display. Each filter works on bands of rows, so a frame can be
+// split up between a few worker threads
+
+enum Filter {
+    FILTER_NONE,
+    FILTER_SCALE2X,
+    FILTER_SCALE3X,
+    FILTER_XBR2X,
+    // Not bit exact with the reference HQ2x - see video_filter.cpp
+    FILTER_HQ2X_APPROX,
+    FILTER_COUNT
+};
+
+// src is a 256x240 frame of 32 bit pixels with no padding. Rows row_begin to row_end of it are filtered into dst, which is
+// pitch pixels wide and already points at the top left of the output
+typedef void (*FilterKernel)(const uint32_t* src, uint32_t* dst, int pitch, int row_begin, int row_end);
+
+struct FilterInfo {
+    const char* name;
+    // Output size is 256 * scale by 240 * scale
+    int scale;
+    FilterKernel kernel;
+    // Whether the kernel has an SSE2 path. The others are plain loops and lean on the worker pool for their speed
+    bool vectorized;
+};
+
+// nullptr for FILTER_NONE or anything out of range
+const FilterInfo* get_filter_info(int filter);
+
+// Runs a filter on a pool of worker threads, one frame behind emulation. The PPU draws into one of two input buffers; once it's
+// done, submit() hands that buffer to the workers and the PPU moves on to the other one. The filtered frame is only needed at the
+// end of the next frame, so the filtering happens while the next frame is being emulated
+class FilterPipeline {
+
+    private:
+        const FilterInfo* info;
+        uint32_t inputs[2][256 * 240];
+        int current_input;
+
+        // Each band of the frame is a job for the pool
+        WorkStealingPool pool;
+        // The frame being worked on and where it's going
+        const uint32_t* src;
+        uint32_t* dst;
+        int dst_pitch;
+
+        void filter_band(int band);
+
+    public:
+        // The frame is split into this many bands of rows, which workers grab one at a time
+        static const int BANDS = 16;
+
+        FilterPipeline(int filter, int threads);
+
+        // The buffer the next frame should be drawn into (256 * 4 bytes per row)
+        uint8_t* get_input();
+        // Starts filtering the frame in get_input() into dest (pitch is the size of a row in bytes). Returns right away, and
+        // get_input() points at the other buffer afterwards. dest must stay valid until wait() returns
+        void submit(uint8_t* dest, int pitch);
+        // Waits for the last submitted frame to be finished
+        void wait();
+        int get_width() const;
+        int get_height() const;
+        const char* get_name() const;
+
+};
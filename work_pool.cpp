@@ -0,0 +1,93 @@
+#include "work_pool.h"
+#include <algorithm>
+
+WorkStealingPool::WorkStealingPool(int threads) : threads(std::max(1, threads)) {
+    for (int i = 0; i < this->threads; i++) queues.push_back(std::make_unique<Queue>());
+    steals = 0;
+    generation = 0;
+    busy = 0;
+    quitting = false;
+    for (int i = 0; i < this->threads; i++) workers.emplace_back(&WorkStealingPool::worker_loop, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quitting = true;
+    }
+    work_ready.notify_all();
+    for (std::thread& worker : workers) worker.join();
+}
+
+void WorkStealingPool::start(int count, const std::function<void(int, int)>& job) {
+    std::unique_lock<std::mutex> lock(mutex);
+    work_done.wait(lock, [this] { return busy == 0; });
+    // Every worker is asleep, so nothing else is touching the queues
+    for (int i = 0; i < threads; i++) {
+        Queue& queue = *queues[i];
+        for (int index = count * i / threads; index < count * (i + 1) / threads; index++) queue.jobs.push_back(index);
+    }
+    this->job = job;
+    steals = 0;
+    busy = threads;
+    generation++;
+    lock.unlock();
+    work_ready.notify_all();
+}
+
+void WorkStealingPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    work_done.wait(lock, [this] { return busy == 0; });
+}
+
+void WorkStealingPool::run(int count, const std::function<void(int, int)>& job) {
+    start(count, job);
+    wait();
+}
+
+void WorkStealingPool::worker_loop(int worker) {
+    unsigned seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        work_ready.wait(lock, [this, seen] { return quitting || generation != seen; });
+        if (quitting) return;
+        seen = generation;
+        lock.unlock();
+
+        int index;
+        while (take(worker, index)) job(worker, index);
+
+        lock.lock();
+        if (--busy == 0) work_done.notify_all();
+    }
+}
+
+// Our own jobs come off the back and stolen ones off the front, so a thief and the owner only ever want the same job once the
+// queue is down to its last one
+bool WorkStealingPool::take(int worker, int& job) {
+    {
+        Queue& own = *queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            job = own.jobs.back();
+            own.jobs.pop_back();
+            return true;
+        }
+    }
+    for (int i = 1; i < threads; i++) {
+        Queue& victim = *queues[(worker + i) % threads];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            steals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+int WorkStealingPool::get_threads() const { return threads; }
+
+int WorkStealingPool::get_steals() const { return steals; }
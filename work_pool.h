@@ -0,0 +1,58 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+
+// Runs batches of numbered jobs across a fixed number of threads, which are started once and sleep between batches. Each thread
+// starts with its own contiguous share of the jobs and works through it from the back; one that runs out steals from the front of
+// another's, so a few long jobs landing on the same thread don't leave the rest of the cores idle at the end. Jobs don't add more
+// jobs, so once every queue is empty the batch is done
+class WorkStealingPool {
+
+    private:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<int> jobs;
+        };
+
+        int threads;
+        std::vector<std::unique_ptr<Queue>> queues;
+        std::atomic<int> steals;
+
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable work_ready;
+        std::condition_variable work_done;
+        // The batch being worked on. Each one gets a new generation so the workers can tell it from the last, and busy is how many
+        // of them are still on it
+        std::function<void(int, int)> job;
+        unsigned generation;
+        int busy;
+        bool quitting;
+
+        void worker_loop(int worker);
+        bool take(int worker, int& job);
+
+    public:
+        WorkStealingPool(int threads);
+        ~WorkStealingPool();
+
+        // Starts running job(worker, index) for every index below count, and returns right away. worker is which thread it runs on
+        // (0 to threads - 1), so callers can keep state for each thread and reuse it from one job to the next. Waits for the last
+        // batch to finish first
+        void start(int count, const std::function<void(int, int)>& job);
+        // Waits for the batch started last to be finished
+        void wait();
+        // start() and wait() in one
+        void run(int count, const std::function<void(int, int)>& job);
+
+        int get_threads() const;
+        // Jobs run by a thread other than the one they started on, in the last batch
+        int get_steals() const;
+
+};